@@ -0,0 +1,385 @@
+// Latency and throughput benchmark for libbuffer.
+//
+// For every combination of resolution, slot count, synchronization protocol and read
+// mode, one writer (this process) publishes frames into a fresh block while [readers]
+// forked reader processes consume them. Every frame is stamped with CLOCK_MONOTONIC in
+// nanoseconds as its acquisition time, so each reader can measure the writer-to-reader
+// latency of every frame it receives.
+//
+// Reported per configuration:
+//  - p50/p99/p99.9 writer-to-reader latency in nanoseconds, over all readers
+//  - frames per second received per reader
+//  - frames dropped (skipped) by all readers
+//  - CPU time used per reader, as a percentage of a core
+//
+// usage:
+//      bench [--json] [--stats] [--readers N] [--frames N] [--fps N]
+//            [--resolutions 640x480x3,1920x1080x3] [--slots 3,16]
+//            [--sync rwlock,seqlock] [--modes blocking,nonblocking,zerocopy] [--spin NS]
+//
+// --fps 0 makes the writer publish as fast as it can. --json prints one JSON object per
+// configuration and line, so results can be compared between builds. --stats creates the
+// blocks with the [stats] option, to measure its overhead or to watch the run with fbtop.
+// --spin makes blocking readers poll for up to NS nanoseconds before they sleep, see
+// [set_wait_policy].
+#include "buffer.h"
+
+#include <getopt.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CHOICES 16
+
+#define MODE_BLOCKING 0
+#define MODE_NONBLOCKING 1
+#define MODE_ZEROCOPY 2
+
+static const char* mode_names[] = {"blocking", "nonblocking", "zerocopy"};
+static const char* sync_names[] = {"rwlock", "seqlock"};
+
+typedef struct resolution {
+    size_t width, height, depth;
+} resolution_t;
+
+typedef struct config {
+    resolution_t resolutions[MAX_CHOICES];
+    size_t resolution_count;
+    size_t slots[MAX_CHOICES];
+    size_t slot_count;
+    int syncs[MAX_CHOICES];
+    size_t sync_count;
+    int modes[MAX_CHOICES];
+    size_t mode_count;
+    int readers;
+    uint64_t frames;
+    uint64_t fps;
+    uint64_t spin_ns;
+    bool json;
+    bool stats;
+} config_t;
+
+// written by a reader process, read by the writer once the reader exited
+typedef struct reader_result {
+    uint64_t frames;
+    uint64_t dropped;
+    double elapsed_seconds;
+    double cpu_seconds;
+} reader_result_t;
+
+// lives in memory shared between the writer and all readers of a run
+typedef struct shared_state {
+    _Atomic int ready;
+    reader_result_t results[];
+} shared_state_t;
+
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static double cpu_seconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Consumes [name] until the writer destroys it. Latencies are stored in [samples], which
+// has room for [frames] entries.
+static void run_reader(const char* name, int mode, const config_t* config,
+                       shared_state_t* state, reader_result_t* result, uint64_t* samples) {
+    block_t* block = open_block(name);
+    if (block == NULL) exit(1);
+    wait_policy_t policy = {.spin_ns = config->spin_ns, .yield = false, .cpu = -1};
+    set_wait_policy(block, &policy);
+    uint64_t frames = config->frames;
+    frame_t* frame = create_frame_for_block(block, true);
+    frame_view_t view = {0};
+
+    atomic_fetch_add(&state->ready, 1);
+
+    uint64_t received = 0, dropped = 0, last_uid = 0;
+    uint64_t start = now_ns(), last_received = start;
+    double start_cpu = cpu_seconds(), last_cpu = start_cpu;
+    while (true) {
+        int exit_code;
+        uint64_t frame_uid, acquisition_time;
+        if (mode == MODE_ZEROCOPY) {
+            exit_code = acquire_frame_view(block, &view, true);
+            frame_uid = view.frame_uid;
+            acquisition_time = view.acquisition_time;
+        } else {
+            exit_code = read_frame(block, frame, mode == MODE_BLOCKING);
+            frame_uid = frame->frame_uid;
+            acquisition_time = frame->acquisition_time;
+        }
+        if (exit_code == NO_NEW_FRAME) {
+            sched_yield();
+            continue;
+        }
+        if (exit_code != SUCCESS) break;
+
+        // the latency is measured once the frame is fully available to the reader
+        last_received = now_ns();
+        uint64_t latency = last_received - acquisition_time;
+        if (mode == MODE_ZEROCOPY) release_frame_view(block, &view);
+        last_cpu = cpu_seconds();
+        if (received < frames) samples[received] = latency;
+        received++;
+        dropped += frame_uid - last_uid - 1;
+        last_uid = frame_uid;
+    }
+    // the idle time between the last frame and the teardown is not part of the run
+    result->elapsed_seconds = (last_received - start) / 1e9;
+    result->cpu_seconds = last_cpu - start_cpu;
+    result->frames = received;
+    result->dropped = dropped + (frames - last_uid);
+
+    delete_frame(frame);
+    close_block(block);
+}
+
+static void run(const config_t* config, resolution_t resolution, size_t slots, int sync,
+                int mode) {
+    char name[64];
+    snprintf(name, sizeof(name), "bench-%d", getpid());
+
+    block_options_t options = default_block_options();
+    options.slot_count = slots;
+    options.sync_mode = sync;
+    options.prefault = true;
+    options.stats = config->stats;
+    block_t* block = create_block_ex(name, resolution.width, resolution.height,
+                                     resolution.depth, &options);
+    if (block == NULL) {
+        fprintf(stderr, "failed to create block %s\n", name);
+        exit(1);
+    }
+
+    size_t readers = config->readers;
+    size_t state_size = sizeof(shared_state_t) + sizeof(reader_result_t) * readers;
+    size_t samples_size = sizeof(uint64_t) * config->frames * readers;
+    shared_state_t* state = mmap(NULL, state_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    uint64_t* samples = mmap(NULL, samples_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    atomic_init(&state->ready, 0);
+
+    for (size_t i = 0; i < readers; i++) {
+        if (fork() == 0) {
+            run_reader(name, mode, config, state, &state->results[i],
+                       &samples[config->frames * i]);
+            _exit(0);
+        }
+    }
+    while (atomic_load(&state->ready) < (int)readers) usleep(1000);
+
+    size_t image_size = block_image_size(block);
+    image* source = malloc(image_size);
+    memset(source, 0x5a, image_size);
+
+    uint64_t period = config->fps ? 1000000000ull / config->fps : 0;
+    uint64_t deadline = now_ns();
+    for (uint64_t i = 0; i < config->frames; i++) {
+        if (period) {
+            deadline += period;
+            struct timespec until = {deadline / 1000000000ull, deadline % 1000000000ull};
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+        }
+        write_frame(block, resolution.width, resolution.height, resolution.depth, now_ns(),
+                    source);
+    }
+    // give the readers a moment to pick up the last frame before the block goes away
+    usleep(50000);
+    destroy_block(block);
+    for (size_t i = 0; i < readers; i++) wait(NULL);
+
+    // aggregate
+    size_t sample_count = 0;
+    uint64_t frames = 0, dropped = 0;
+    double fps = 0, cpu = 0;
+    for (size_t i = 0; i < readers; i++) {
+        reader_result_t* result = &state->results[i];
+        uint64_t kept = result->frames < config->frames ? result->frames : config->frames;
+        memmove(&samples[sample_count], &samples[config->frames * i], kept * sizeof(uint64_t));
+        sample_count += kept;
+        frames += result->frames;
+        dropped += result->dropped;
+        if (result->elapsed_seconds > 0) {
+            fps += result->frames / result->elapsed_seconds / readers;
+            cpu += 100.0 * result->cpu_seconds / result->elapsed_seconds / readers;
+        }
+    }
+    qsort(samples, sample_count, sizeof(uint64_t), compare_u64);
+    uint64_t p50 = 0, p99 = 0, p999 = 0;
+    if (sample_count) {
+        p50 = samples[sample_count * 500 / 1000];
+        p99 = samples[sample_count * 990 / 1000];
+        p999 = samples[sample_count * 999 / 1000];
+    }
+
+    if (config->json) {
+        printf("{\"width\": %zu, \"height\": %zu, \"depth\": %zu, \"slots\": %zu, "
+               "\"sync\": \"%s\", \"mode\": \"%s\", \"readers\": %zu, \"frames\": %lu, "
+               "\"target_fps\": %lu, \"spin_ns\": %lu, \"latency_ns\": {\"p50\": %lu, "
+               "\"p99\": %lu, \"p99.9\": %lu}, \"fps\": %.1f, \"frames_read\": %lu, "
+               "\"dropped\": %lu, \"cpu_percent_per_reader\": %.1f}\n",
+               resolution.width, resolution.height, resolution.depth, slots, sync_names[sync],
+               mode_names[mode], readers, config->frames, config->fps, config->spin_ns, p50,
+               p99, p999, fps, frames, dropped, cpu);
+    } else {
+        char dimensions[32];
+        snprintf(dimensions, sizeof(dimensions), "%zux%zux%zu", resolution.width,
+                 resolution.height, resolution.depth);
+        printf("%-17s %5zu %-8s %-12s %12lu %12lu %12lu %9.1f %9lu %7.1f%%\n",
+               dimensions, slots, sync_names[sync], mode_names[mode], p50, p99, p999, fps,
+               dropped, cpu);
+    }
+    fflush(stdout);
+
+    free(source);
+    munmap(samples, samples_size);
+    munmap(state, state_size);
+}
+
+// parses a comma separated list with [parse_one], returns the number of entries
+static size_t parse_list(char* list, void* out, size_t size,
+                         bool (*parse_one)(const char*, void*)) {
+    size_t count = 0;
+    for (char* item = strtok(list, ","); item != NULL; item = strtok(NULL, ",")) {
+        if (count == MAX_CHOICES || !parse_one(item, (char*)out + size * count)) {
+            fprintf(stderr, "invalid list entry \"%s\"\n", item);
+            exit(2);
+        }
+        count++;
+    }
+    return count;
+}
+
+static bool parse_resolution(const char* item, void* out) {
+    resolution_t* resolution = out;
+    return sscanf(item, "%zux%zux%zu", &resolution->width, &resolution->height,
+                  &resolution->depth) == 3;
+}
+
+static bool parse_slots(const char* item, void* out) {
+    return sscanf(item, "%zu", (size_t*)out) == 1 && *(size_t*)out > 0;
+}
+
+static bool parse_name(const char* item, const char** names, size_t name_count, int* out) {
+    for (size_t i = 0; i < name_count; i++) {
+        if (strcmp(item, names[i]) == 0) {
+            *out = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_sync(const char* item, void* out) {
+    return parse_name(item, sync_names, 2, out);
+}
+
+static bool parse_mode(const char* item, void* out) {
+    return parse_name(item, mode_names, 3, out);
+}
+
+int main(int argc, char** argv) {
+    config_t config = {
+        .resolutions = {{640, 480, 3}, {1920, 1080, 3}, {3840, 2160, 3}},
+        .resolution_count = 3,
+        .slots = {3, 16},
+        .slot_count = 2,
+        .syncs = {SYNC_RWLOCK, SYNC_SEQLOCK},
+        .sync_count = 2,
+        .modes = {MODE_BLOCKING, MODE_NONBLOCKING, MODE_ZEROCOPY},
+        .mode_count = 3,
+        .readers = 4,
+        .frames = 300,
+        .fps = 240,
+        .spin_ns = 0,
+        .json = false,
+        .stats = false,
+    };
+
+    static struct option long_options[] = {
+        {"json", no_argument, NULL, 'j'},
+        {"stats", no_argument, NULL, 'x'},
+        {"readers", required_argument, NULL, 'r'},
+        {"frames", required_argument, NULL, 'f'},
+        {"fps", required_argument, NULL, 'p'},
+        {"resolutions", required_argument, NULL, 'R'},
+        {"slots", required_argument, NULL, 's'},
+        {"sync", required_argument, NULL, 'S'},
+        {"modes", required_argument, NULL, 'm'},
+        {"spin", required_argument, NULL, 'w'},
+        {NULL, 0, NULL, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (option) {
+            case 'j':
+                config.json = true;
+                break;
+            case 'x':
+                config.stats = true;
+                break;
+            case 'r':
+                config.readers = atoi(optarg);
+                break;
+            case 'f':
+                config.frames = strtoull(optarg, NULL, 10);
+                break;
+            case 'p':
+                config.fps = strtoull(optarg, NULL, 10);
+                break;
+            case 'R':
+                config.resolution_count = parse_list(optarg, config.resolutions,
+                                                     sizeof(resolution_t), parse_resolution);
+                break;
+            case 's':
+                config.slot_count = parse_list(optarg, config.slots, sizeof(size_t), parse_slots);
+                break;
+            case 'S':
+                config.sync_count = parse_list(optarg, config.syncs, sizeof(int), parse_sync);
+                break;
+            case 'm':
+                config.mode_count = parse_list(optarg, config.modes, sizeof(int), parse_mode);
+                break;
+            case 'w':
+                config.spin_ns = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                return 2;
+        }
+    }
+    if (config.readers < 1 || config.frames < 1) {
+        fprintf(stderr, "--readers and --frames must be at least 1\n");
+        return 2;
+    }
+
+    if (!config.json)
+        printf("%-17s %5s %-8s %-12s %12s %12s %12s %9s %9s %8s\n", "resolution", "slots",
+               "sync", "mode", "p50 ns", "p99 ns", "p99.9 ns", "fps", "dropped", "cpu");
+    for (size_t r = 0; r < config.resolution_count; r++)
+        for (size_t s = 0; s < config.slot_count; s++)
+            for (size_t y = 0; y < config.sync_count; y++)
+                for (size_t m = 0; m < config.mode_count; m++)
+                    run(&config, config.resolutions[r], config.slots[s], config.syncs[y],
+                        config.modes[m]);
+    return 0;
+}
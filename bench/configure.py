@@ -0,0 +1,29 @@
+#!/usr/bin/env python3
+import sys
+from ninja_syntax import Writer
+
+outfile = sys.argv[1]
+builddir = f"{outfile.replace('build.ninja', 'binaries')}"
+
+
+ninja = Writer(output=open(outfile, 'w'))
+ninja.variable('builddir', builddir)
+
+ninja.rule('run-bench',
+           command='$in --json > $out',
+           description='benchmark $out',
+           pool='console',
+           )
+ninja.newline()
+
+ninja.build('$builddir/bench.o', 'cc', 'bench/bench.c',
+            variables={'cflags': '$cflags -O2 -Ilib/c'})
+ninja.build('$builddir/bench', 'cc-exe',
+            ['$builddir/bench.o', 'lib/binaries/buffer.o',
+             'lib/binaries/convert.o'],
+            variables={'libs': '-lpthread'})
+ninja.default('$builddir/bench')
+
+# `ninja benchmark` runs the default sweep and records one JSON object per configuration
+ninja.build('$builddir/results.json', 'run-bench', '$builddir/bench')
+ninja.build('benchmark', 'phony', '$builddir/results.json')
@@ -3,33 +3,70 @@ import os
 import sys
 from ninja_syntax import Writer
 
-IS_DEBUG = True
+# the build profile, e.g. `PROFILE=release ./configure.py`
+#  - debug: -g without optimizations
+#  - release: -O3 with link time optimization, for any x86-64 or aarch64 machine. The
+#      conversion kernels pick AVX2 or AVX-512 clones at load time on x86-64
+#  - native: release tuned for the building machine with -march=native, the binaries
+#      may not run anywhere else
+PROFILE = os.environ.get('PROFILE', 'debug')
+# profile guided optimization of release builds, trained by `ninja benchmark`
+#  - generate: instrument the build, `ninja benchmark` then records profiles in PGO_DIR
+#  - use: optimize with the profiles recorded by a generate build
+PGO = os.environ.get('PGO', '')
+PGO_DIR = os.path.abspath('pgo')
 BUILD_EXAMPLES = True
+BUILD_BENCH = True
+BUILD_TOOLS = True
+# builds read_frame_to_device into libbuffer.so, against the CUDA toolkit at CUDA_HOME
+BUILD_CUDA = False
+CUDA_HOME = os.environ.get('CUDA_HOME', '/usr/local/cuda')
 
-# process is_debug flags
-cflags = ['-Wall', '-Werror']
-cppflags = []
+profiles = {
+    'debug': ['-g'],
+    'release': ['-O3', '-flto=auto'],
+    'native': ['-O3', '-flto=auto', '-march=native'],
+}
+pgo_flags = {
+    '': [],
+    'generate': [f'-fprofile-generate={PGO_DIR}'],
+    # code the benchmark never runs has no profile, which is fine
+    'use': [f'-fprofile-use={PGO_DIR}', '-fprofile-partial-training', '-Wno-missing-profile'],
+}
+if PROFILE not in profiles or PGO not in pgo_flags:
+    print(f'unknown PROFILE "{PROFILE}" or PGO "{PGO}"')
+    sys.exit(1)
 
-if IS_DEBUG:
-    cflags += ['-g']
-    cppflags += ['-g']
-else:
-    cflags += ['-O3']
-    cppflags += ['-O3']
+cflags = ['-Wall', '-Werror'] + profiles[PROFILE] + pgo_flags[PGO]
+cppflags = ['-Wall', '-Werror'] + profiles[PROFILE] + pgo_flags[PGO]
 
 # process build_examples
 dirs = ['lib']
 if BUILD_EXAMPLES:
     dirs += ['examples']
+if BUILD_BENCH:
+    dirs += ['bench']
+if BUILD_TOOLS:
+    dirs += ['tools']
+
+# the sub-configurations learn about optional features from their environment, both
+# here and when ninja reruns them
+configure_env = {'PROFILE': PROFILE}
+if PGO:
+    configure_env['PGO'] = PGO
+if BUILD_CUDA:
+    configure_env['FRAMEBUFFER_CUDA'] = CUDA_HOME
+os.environ.update(configure_env)
 
 
 ninja = Writer(output=open('build.ninja', 'w'))
 
 ninja.variable('cflags', ' '.join(cflags))
-ninja.variable('cppflags', ' '.join(cflags))
+ninja.variable('cppflags', ' '.join(cppflags))
 ninja.newline()
 ninja.variable('cc', 'gcc')
 ninja.variable('cxx', 'g++')
+ninja.variable('configure_env', ' '.join(f'{k}={v}' for k, v in configure_env.items()))
 ninja.newline()
 
 ninja.rule('cc',
@@ -38,7 +75,12 @@ ninja.rule('cc',
            )
 
 ninja.rule('cc-shared',
-           command='$cc $cflags -shared $in -o $out',
+           command='$cc $cflags -shared $in -o $out $libs',
+           description='cc $out',
+           )
+
+ninja.rule('cc-exe',
+           command='$cc $cflags $in -o $out $libs',
            description='cc $out',
            )
 
@@ -47,7 +89,7 @@ ninja.rule('cxx',
            description='cxx $out',
            )
 ninja.rule('configure',
-           command='./$in $out',
+           command='$configure_env ./$in $out',
            description='configure $out',
            generator=True
            )
@@ -1,14 +1,19 @@
+import asyncio
 import numpy as np
-import time
+import _framebuffer
 from ctypes import (
     POINTER,
     c_ubyte,
+    c_uint32,
     c_uint64,
     c_char_p,
     c_void_p,
     c_ssize_t,
     c_bool,
+    c_char,
+    c_double,
     c_int32,
+    c_int,
     Structure,
     addressof,
     cdll
@@ -19,6 +24,132 @@ SUCCESS = 0
 FRAME_SIZE_MISMATCH = 1
 BLOCK_NOT_ACTIVE = 2
 NO_NEW_FRAME = 3
+NO_FRAME_IN_PROGRESS = 4
+FRAME_OVERWRITTEN = 5
+FRAME_DROPPED = 6
+NO_READER_SLOT = 7
+CONVERSION_NOT_SUPPORTED = 8
+INVALID_REGION = 9
+
+# where the image data of a _Frame comes from
+FRAME_STORAGE_MALLOC = 0
+FRAME_STORAGE_PAGE_ALIGNED = 1
+FRAME_STORAGE_CALLER = 2
+
+# slot synchronization protocols
+SYNC_RWLOCK = 0
+SYNC_SEQLOCK = 1
+
+# what the writer does when a reliable reader would miss a frame
+BACKPRESSURE_OVERWRITE = 0
+BACKPRESSURE_BLOCK = 1
+BACKPRESSURE_SKIP = 2
+
+# units of acquisition times, see BufferedFrameWriter
+TIMESTAMP_MILLISECONDS = 0
+TIMESTAMP_NANOSECONDS = 1
+
+# conversions of BufferedFrameReader.get_next_frame
+CONVERT_COPY = 0
+CONVERT_BGR_TO_RGB = 1
+CONVERT_BGR_TO_GRAY = 2
+
+# pages that back a buffer
+PAGES_DEFAULT = 0
+PAGES_TRANSPARENT_HUGE = 1
+PAGES_HUGETLB_2MB = 2
+PAGES_HUGETLB_1GB = 3
+
+# codec tags of frame payloads, any other four character code works as well
+
+
+def fourcc(code: str):
+    """Returns the codec tag of the four character `code`, e.g. `fourcc('VP80')`."""
+    a, b, c, d = code.encode("ascii")
+    return a | (b << 8) | (c << 16) | (d << 24)
+
+
+CODEC_RAW = 0
+CODEC_JPEG = fourcc('MJPG')
+CODEC_H264 = fourcc('H264')
+CODEC_H265 = fourcc('HEVC')
+CODEC_LZ4 = fourcc('LZ4 ')
+
+# element types and pixel formats of images
+ELEMENT_U8 = 0
+ELEMENT_U16 = 1
+ELEMENT_F32 = 2
+
+PIXEL_FORMAT_U8 = 0
+PIXEL_FORMAT_U16 = 1
+PIXEL_FORMAT_F32 = 2
+PIXEL_FORMAT_NV12 = 3
+PIXEL_FORMAT_I420 = 4
+
+MAX_PLANES = 3
+MAX_DERIVED_LEVELS = 4
+
+# numpy types of the elements, and the pixel formats numpy arrays are written as
+_ELEMENT_DTYPES = {
+    ELEMENT_U8: np.dtype(np.uint8),
+    ELEMENT_U16: np.dtype(np.uint16),
+    ELEMENT_F32: np.dtype(np.float32),
+}
+_PIXEL_FORMATS = {
+    np.dtype(np.uint8): PIXEL_FORMAT_U8,
+    np.dtype(np.uint16): PIXEL_FORMAT_U16,
+    np.dtype(np.float32): PIXEL_FORMAT_F32,
+}
+
+# default number of images held in a buffer
+BUFFER_COUNT = 3
+
+# maximum number of readers of a block that register for notifications or stats
+MAX_READERS = 32
+
+# limits of the registry of blocks, see list_blocks
+MAX_LISTED_BLOCKS = 256
+MAX_DIRECTION_LENGTH = 63
+
+
+class _Plane(Structure):
+    _fields_ = [
+        ("offset", c_ssize_t),
+        ("width", c_ssize_t),
+        ("height", c_ssize_t),
+        ("channels", c_ssize_t),
+        ("stride", c_ssize_t),
+    ]
+
+
+class _ImageFormat(Structure):
+    _fields_ = [
+        ("pixel_format", c_int),
+        ("element_type", c_int),
+        ("element_size", c_ssize_t),
+        ("plane_count", c_ssize_t),
+        ("planes", _Plane * MAX_PLANES),
+        ("size", c_ssize_t),
+    ]
+
+
+def _image_arrays(buffer, offset, image_format, count=None, frame_stride=0):
+    # numpy views of an image laid out as `image_format` at `offset` bytes into
+    # `buffer`: a (height, width, channels) array for single plane formats, a
+    # tuple of one such array per plane for NV12/I420. With `count`, every array
+    # gets a leading axis of `count` images that are `frame_stride` bytes apart.
+    dtype = _ELEMENT_DTYPES[image_format.element_type]
+    arrays = []
+    for i in range(image_format.plane_count):
+        plane = image_format.planes[i]
+        shape = (plane.height, plane.width, plane.channels)
+        strides = (plane.stride, plane.channels * dtype.itemsize, dtype.itemsize)
+        if count is not None:
+            shape = (count,) + shape
+            strides = (frame_stride,) + strides
+        arrays.append(np.ndarray(shape, dtype, buffer=buffer,
+                                 offset=offset + plane.offset, strides=strides))
+    return arrays[0] if len(arrays) == 1 else tuple(arrays)
 
 
 class _Frame(Structure):
@@ -29,20 +160,152 @@ class _Frame(Structure):
         ("acquisition_time", c_uint64),
         ("frame_uid", c_uint64),
         ("data", POINTER(c_ubyte)),
+        ("capacity", c_ssize_t),
+        ("storage", c_int),
+        ("payload_size", c_ssize_t),
+        ("codec", c_uint32),
+        ("format", _ImageFormat),
+    ]
+
+
+class _FrameView(Structure):
+    _fields_ = [
+        ("width", c_ssize_t),
+        ("height", c_ssize_t),
+        ("depth", c_ssize_t),
+        ("acquisition_time", c_uint64),
+        ("frame_uid", c_uint64),
+        ("data", POINTER(c_ubyte)),
+        ("slot", c_int),
+        ("seq", c_uint64),
+        ("payload_size", c_ssize_t),
+        ("codec", c_uint32),
+        ("format", _ImageFormat),
+    ]
+
+
+class _DerivedLevel(Structure):
+    _fields_ = [
+        ("conversion", c_int),
+        ("scale", c_ssize_t),
+    ]
+
+
+class _BlockOptions(Structure):
+    _fields_ = [
+        ("slot_count", c_ssize_t),
+        ("sync_mode", c_int),
+        ("page_mode", c_int),
+        ("hugetlbfs_dir", c_char_p),
+        ("lock_memory", c_bool),
+        ("prefault", c_bool),
+        ("numa_node", c_int),
+        ("stats", c_bool),
+        ("backpressure", c_int),
+        ("max_payload_size", c_ssize_t),
+        ("pixel_format", c_int),
+        ("row_alignment", c_ssize_t),
+        ("derived_count", c_ssize_t),
+        ("derived", _DerivedLevel * MAX_DERIVED_LEVELS),
+        ("multi_producer", c_bool),
+        ("timestamp_unit", c_int),
+    ]
+
+
+class _WaitPolicy(Structure):
+    _fields_ = [
+        ("spin_ns", c_uint64),
+        ("yield_", c_bool),
+        ("cpu", c_int),
+    ]
+
+
+class _ReaderStats(Structure):
+    _fields_ = [
+        ("pid", c_int),
+        ("cursor", c_uint64),
+        ("reliable", c_bool),
+        ("frames_read", c_uint64),
+        ("frames_skipped", c_uint64),
+        ("frame_wait_ns", c_uint64),
+        ("lock_wait_ns", c_uint64),
+        ("copy_ns", c_uint64),
+    ]
+
+
+class _BlockStats(Structure):
+    _fields_ = [
+        ("width", c_ssize_t),
+        ("height", c_ssize_t),
+        ("depth", c_ssize_t),
+        ("slot_count", c_ssize_t),
+        ("sync_mode", c_int),
+        ("backpressure", c_int),
+        ("owner", c_int),
+        ("generation", c_uint32),
+        ("is_alive", c_bool),
+        ("enabled", c_bool),
+        ("frames_written", c_uint64),
+        ("frames_dropped", c_uint64),
+        ("write_lock_wait_ns", c_uint64),
+        ("write_copy_ns", c_uint64),
+        ("reader_count", c_ssize_t),
+        ("readers", _ReaderStats * MAX_READERS),
+    ]
+
+
+class _BlockInfo(Structure):
+    _fields_ = [
+        ("direction", c_char * (MAX_DIRECTION_LENGTH + 1)),
+        ("width", c_ssize_t),
+        ("height", c_ssize_t),
+        ("depth", c_ssize_t),
+        ("pixel_format", c_int),
+        ("level_count", c_ssize_t),
+        ("slot_count", c_ssize_t),
+        ("sync_mode", c_int),
+        ("payload_capacity", c_ssize_t),
+        ("fps", c_double),
+        ("owner", c_int),
+        ("generation", c_uint32),
+        ("alive", c_bool),
     ]
 
 
 _lib = cdll.LoadLibrary('libbuffer.so')
 
-# block_t* create_block(const char* direction, size_t width, size_t height, size_t depth);
+# block_t* create_block(const char* direction, size_t width, size_t height, size_t depth,
+#                       size_t slot_count);
 _lib.create_block.argtypes = (
-    c_char_p, c_ssize_t, c_ssize_t, c_ssize_t)
+    c_char_p, c_ssize_t, c_ssize_t, c_ssize_t, c_ssize_t)
 _lib.create_block.restype = c_void_p
 
+# block_t* create_block_ex(const char* direction, size_t width, size_t height, size_t depth,
+#                          const block_options_t* options);
+_lib.create_block_ex.argtypes = (
+    c_char_p, c_ssize_t, c_ssize_t, c_ssize_t, c_void_p)
+_lib.create_block_ex.restype = c_void_p
+
+# block_options_t default_block_options();
+_lib.default_block_options.argtypes = None
+_lib.default_block_options.restype = _BlockOptions
+
 # block_t* open_block(const char* direction);
 _lib.open_block.argtypes = (c_char_p,)
 _lib.open_block.restype = c_void_p
 
+# block_t* open_block_level(const char* direction, size_t level);
+_lib.open_block_level.argtypes = (c_char_p, c_ssize_t)
+_lib.open_block_level.restype = c_void_p
+
+# block_t* open_block_producer(const char* direction);
+_lib.open_block_producer.argtypes = (c_char_p,)
+_lib.open_block_producer.restype = c_void_p
+
+# block_t* wait_for_block(const char* direction, size_t level, int timeout_ms);
+_lib.wait_for_block.argtypes = (c_char_p, c_ssize_t, c_int)
+_lib.wait_for_block.restype = c_void_p
+
 # bool cstr_block_is_poisoned(const char* direction);
 _lib.cstr_block_is_poisoned.argtypes = (c_char_p,)
 _lib.cstr_block_is_poisoned.restype = c_bool
@@ -50,6 +313,10 @@ _lib.cstr_block_is_poisoned.restype = c_bool
 _lib.block_is_poisoned.argtypes = (c_void_p,)
 _lib.block_is_poisoned.restype = c_bool
 
+# block_t* reclaim_block(const char* direction);
+_lib.reclaim_block.argtypes = (c_char_p,)
+_lib.reclaim_block.restype = c_void_p
+
 # bool cstr_block_is_alive(const char* direction);
 _lib.cstr_block_is_alive.argtypes = (c_void_p,)
 _lib.cstr_block_is_alive.restype = c_bool
@@ -66,27 +333,64 @@ _lib.destroy_block.restype = None
 _lib.close_block.argtypes = (c_void_p,)
 _lib.close_block.restype = None
 
-# int write_frame(block_t* block, size_t width, size_t height,
-#                 size_t depth, uint64_t acquisition_time, image* data);
-_lib.write_frame.argtypes = (
-    c_void_p,
-    c_ssize_t,
-    c_ssize_t,
-    c_ssize_t,
-    c_uint64,
-    c_void_p,
-)
-_lib.write_frame.restype = c_int32
+# write_frame, write_packet, read_frame, read_frame_converted and read_frame_roi are
+# called through _framebuffer, which releases the GIL while they copy and wait
+
+# image* begin_write_frame(block_t* block);
+_lib.begin_write_frame.argtypes = (c_void_p,)
+_lib.begin_write_frame.restype = POINTER(c_ubyte)
+
+# int commit_write_frame(block_t* block, uint64_t acquisition_time);
+_lib.commit_write_frame.argtypes = (c_void_p, c_uint64)
+_lib.commit_write_frame.restype = c_int32
+
+# int commit_write_packet(block_t* block, size_t size, uint32_t codec,
+#                         uint64_t acquisition_time);
+_lib.commit_write_packet.argtypes = (c_void_p, c_ssize_t, c_uint32, c_uint64)
+_lib.commit_write_packet.restype = c_int32
+
+# int acquire_frame_view_roi(block_t* block, frame_view_t* view, size_t x, size_t y,
+#                            size_t width, size_t height, bool block_thread);
+_lib.acquire_frame_view_roi.argtypes = (
+    c_void_p, c_void_p, c_ssize_t, c_ssize_t, c_ssize_t, c_ssize_t, c_bool)
+_lib.acquire_frame_view_roi.restype = c_int32
+
+# int acquire_frame_view(block_t* block, frame_view_t* view, bool block_thread);
+_lib.acquire_frame_view.argtypes = (c_void_p, c_void_p, c_bool)
+_lib.acquire_frame_view.restype = c_int32
 
-# int read_frame(block_t* block, frame_t* frame);
-_lib.read_frame.argtypes = (c_void_p, c_void_p, c_bool)
-_lib.read_frame.restype = c_int32
+# int release_frame_view(block_t* block, frame_view_t* view);
+_lib.release_frame_view.argtypes = (c_void_p, c_void_p)
+_lib.release_frame_view.restype = c_int32
 
+# int read_frames(block_t* block, frame_t* frames, size_t n, size_t* frames_read,
+#                 bool block_thread);
+_lib.read_frames.argtypes = (c_void_p, c_void_p, c_ssize_t, POINTER(c_ssize_t), c_bool)
+_lib.read_frames.restype = c_int32
+
+# int acquire_frame_views(block_t* block, frame_view_t* views, size_t n,
+#                         size_t* views_acquired, bool block_thread);
+_lib.acquire_frame_views.argtypes = (
+    c_void_p, c_void_p, c_ssize_t, POINTER(c_ssize_t), c_bool)
+_lib.acquire_frame_views.restype = c_int32
+
+# int read_synced(block_t** blocks, size_t n, uint64_t tolerance_ns, frame_view_t* views,
+#                 bool block_thread);
+_lib.read_synced.argtypes = (c_void_p, c_ssize_t, c_uint64, c_void_p, c_bool)
+_lib.read_synced.restype = c_int32
 
 # frame_t* create_frame();
 _lib.create_frame.argtypes = None
 _lib.create_frame.restype = c_void_p
 
+# frame_t* create_frame_for_block(const block_t* block, bool page_aligned);
+_lib.create_frame_for_block.argtypes = (c_void_p, c_bool)
+_lib.create_frame_for_block.restype = c_void_p
+
+# frame_t* create_frame_with_storage(image* data, size_t capacity);
+_lib.create_frame_with_storage.argtypes = (c_void_p, c_ssize_t)
+_lib.create_frame_with_storage.restype = c_void_p
+
 # void delete_frame(frame_t* ptr);
 _lib.delete_frame.argtypes = c_void_p,
 _lib.delete_frame.restype = None
@@ -95,6 +399,76 @@ _lib.delete_frame.restype = None
 _lib.block_image_size.argtypes = c_void_p,
 _lib.block_image_size.restype = c_ssize_t
 
+# image_format_t block_image_format(const block_t* b);
+_lib.block_image_format.argtypes = c_void_p,
+_lib.block_image_format.restype = _ImageFormat
+
+# size_t block_payload_capacity(const block_t* b);
+_lib.block_payload_capacity.argtypes = c_void_p,
+_lib.block_payload_capacity.restype = c_ssize_t
+
+# int block_timestamp_unit(const block_t* b);
+_lib.block_timestamp_unit.argtypes = c_void_p,
+_lib.block_timestamp_unit.restype = c_int
+
+# int block_notify_fd(block_t* block);
+_lib.block_notify_fd.argtypes = c_void_p,
+_lib.block_notify_fd.restype = c_int
+
+# size_t block_slot_count(const block_t* b);
+_lib.block_slot_count.argtypes = c_void_p,
+_lib.block_slot_count.restype = c_ssize_t
+
+# bool set_wait_policy(block_t* block, const wait_policy_t* policy);
+_lib.set_wait_policy.argtypes = (c_void_p, c_void_p)
+_lib.set_wait_policy.restype = c_bool
+
+# int register_reader(block_t* block, bool reliable);
+_lib.register_reader.argtypes = (c_void_p, c_bool)
+_lib.register_reader.restype = c_int
+
+# void block_stats(const block_t* block, block_stats_t* stats);
+_lib.block_stats.argtypes = (c_void_p, c_void_p)
+_lib.block_stats.restype = None
+
+# size_t list_blocks(block_info_t* blocks, size_t n);
+_lib.list_blocks.argtypes = (c_void_p, c_ssize_t)
+_lib.list_blocks.restype = c_ssize_t
+
+# bool watch_blocks(uint32_t* version, int timeout_ms);
+_lib.watch_blocks.argtypes = (POINTER(c_uint32), c_int)
+_lib.watch_blocks.restype = c_bool
+
+
+def list_blocks():
+    # the blocks of this machine as a list of dicts, without opening any of them
+    blocks = (_BlockInfo * MAX_LISTED_BLOCKS)()
+    count = _lib.list_blocks(addressof(blocks), MAX_LISTED_BLOCKS)
+    return [{field: getattr(blocks[i], field) for field, _ in _BlockInfo._fields_}
+            | {"direction": blocks[i].direction.decode()}
+            for i in range(count)]
+
+
+def watch_blocks(version: int = 0, timeout_ms: int = -1):
+    # waits for a block to be created or destroyed after the registry was at `version`,
+    # returns the version it is at now, which is `version` again on a timeout
+    current = c_uint32(version)
+    _lib.watch_blocks(current, timeout_ms)
+    return current.value
+
+
+def _block_stats(block):
+    # the snapshot as plain python values, readers as a list of dicts
+    stats = _BlockStats()
+    _lib.block_stats(block, addressof(stats))
+    result = {field: getattr(stats, field)
+              for field, _ in _BlockStats._fields_ if field != "readers"}
+    result["readers"] = [
+        {field: getattr(stats.readers[i], field)
+         for field, _ in _ReaderStats._fields_}
+        for i in range(stats.reader_count)]
+    return result
+
 
 class ExistentialError(Exception):
     pass
@@ -105,45 +479,222 @@ class NoFrameError(Exception):
 
 
 class BufferedFrameWriter:
-    def __init__(self, name: str):
-        """Creates a frame buffer accessible by `name`
+    def __init__(self, name: str, slot_count: int = BUFFER_COUNT,
+                 lock_free: bool = False, derived=(), **options):
+        """Creates a frame buffer accessible by `name` that holds
+        `slot_count` frames. If `lock_free` is True, slots are protected by
+        sequence numbers instead of locks, so readers can never slow down
+        the writer.
+
+        Any other field of `block_options_t` can be passed by name, e.g.
+        `BufferedFrameWriter('forward', page_mode=PAGES_HUGETLB_2MB,
+        prefault=True, numa_node=0)`. Pass `stats=True` to collect the
+        counters returned by `stats`, and e.g. `backpressure=BACKPRESSURE_BLOCK`
+        to wait for reliable readers instead of overwriting frames they have not
+        read yet. Pass `max_payload_size` to publish encoded frames with
+        `write_packet`, and `multi_producer=True` to let `BufferedFrameProducer`s
+        write to the block as well. Acquisition times are in milliseconds, unless
+        `timestamp_unit=TIMESTAMP_NANOSECONDS` is given.
+
+        The pixel format follows the dtype of the first frame (uint8, uint16 or
+        float32) unless `pixel_format` is given. NV12 and I420 frames are
+        passed in OpenCV's layout, a `(height * 3 // 2, width)` uint8 array
+        with the chroma planes below the luma plane.
+
+        `derived` lists `(conversion, scale)` pairs of levels that are computed
+        once per frame for all readers, e.g. `[(CONVERT_COPY, 2),
+        (CONVERT_BGR_TO_GRAY, 4)]`. Readers open level `i + 1` with
+        `BufferedFrameReader(name, level=i + 1)`.
+
+        With `row_alignment`, every row of the block is padded to a multiple of
+        that many bytes. `write_frame` still takes packed frames, but copies
+        them into the slot row by row; fill the strided arrays of `begin_frame`
+        instead to write such frames without that copy.
         """
         self.name = name
+        self._options = _lib.default_block_options()
+        self._options.slot_count = slot_count
+        if lock_free:
+            self._options.sync_mode = SYNC_SEQLOCK
+        fields = {field for field, _ in _BlockOptions._fields_}
+        for field, value in options.items():
+            if field not in fields:
+                raise TypeError(f"unknown block option '{field}'")
+            if isinstance(value, str):
+                value = value.encode("utf-8")
+            setattr(self._options, field, value)
+        if len(derived) > MAX_DERIVED_LEVELS:
+            raise ValueError(
+                f"at most {MAX_DERIVED_LEVELS} derived levels are supported")
+        self._options.derived_count = len(derived)
+        for i, (conversion, scale) in enumerate(derived):
+            self._options.derived[i].conversion = conversion
+            self._options.derived[i].scale = scale
+        self._explicit_format = "pixel_format" in options
         self._block = None
+        self._image_size = None
 
     def write_frame(self, frame: np.ndarray, acq_time: np.uint64):
-        """Writes `frame` to the frame buffer. `act_time` is the 
-        time in milliseconds when `frame` was acquired.
+        """Writes `frame` to the frame buffer. `act_time` is the
+        time when `frame` was acquired, in the unit of `timestamp_unit`. Returns `False` if the
+        frame was not written, e.g. because it was dropped for a reliable reader
+        that is behind (`BACKPRESSURE_SKIP`).
         """
+        width, height, depth = self._dimensions(frame.shape)
+        self._create_block(width, height, depth, frame.dtype)
+        frame = np.ascontiguousarray(frame)
+        if self._image_size is None:
+            self._image_size = _lib.block_image_size(self._block)
+        if frame.nbytes != self._image_size and self._block_shape == (width, height, depth):
+            return self._write_padded(frame, acq_time)
+
+        exit_code = _framebuffer.write_frame(
+            self._block, width, height, depth, acq_time, frame)
+
+        if exit_code == FRAME_SIZE_MISMATCH:
+            print(
+                "Error: frame size mismatch. Please ensure input frames are consistent.")
+        elif exit_code == BLOCK_NOT_ACTIVE:
+            print("Block is not active.")
+        return exit_code == SUCCESS
+
+    def write_packet(self, packet, codec, acq_time: np.uint64, shape=None):
+        """Writes the encoded frame `packet` (any bytes-like object, e.g. a
+        JPEG image or an H.264 access unit) to the frame buffer, tagged with
+        `codec`. Requires a writer created with `max_payload_size`. `shape` is
+        the shape of the decoded image, which readers may use to allocate
+        decoders; it only matters for the first packet. Returns `False` if the
+        packet was not written.
+        """
+        if self._options.max_payload_size == 0:
+            raise ValueError("write_packet requires a max_payload_size")
+        width, height, depth = self._dimensions(shape) if shape else (0, 0, 0)
+        self._create_block(width, height, depth)
+
+        exit_code = _framebuffer.write_packet(
+            self._block, packet, codec, acq_time)
+
+        if exit_code == FRAME_SIZE_MISMATCH:
+            print(f"Error: packet of {memoryview(packet).nbytes} bytes exceeds "
+                  "max_payload_size.")
+        elif exit_code == BLOCK_NOT_ACTIVE:
+            print("Block is not active.")
+        return exit_code == SUCCESS
+
+    def begin_frame(self, shape, dtype=np.uint8):
+        """Returns a writable numpy array of `shape` and `dtype` that lives
+        directly in the next slot of the frame buffer, or `None` if the block is
+        not active or the frame is dropped for a reliable reader that is behind.
+        Fill it in place (e.g. `cv2.VideoCapture.read(image=...)`) and publish it
+        with `commit_frame`. The array must not be used after the commit.
+        Blocks with padded rows (`row_alignment`) return strided arrays, one per
+        plane, instead.
+        """
+        width, height, depth = self._dimensions(shape)
+        self._create_block(width, height, depth, np.dtype(dtype))
+
+        image_format = _lib.block_image_format(self._block)
+        dtype = _ELEMENT_DTYPES[image_format.element_type]
+        packed = int(np.prod(shape)) * dtype.itemsize == image_format.size
+        if self._block_shape != (width, height, depth):
+            print(
+                "Error: frame size mismatch. Please ensure input frames are consistent.")
+            return None
+
+        data = _lib.begin_write_frame(self._block)
+        if not data:
+            if not _lib.block_is_alive(self._block):
+                print("Block is not active.")
+            return None
+        slot = np.ctypeslib.as_array(data, (image_format.size,))
+        if packed:
+            return slot.view(dtype).reshape(shape)
+        return _image_arrays(slot, 0, image_format)
+
+    def _write_padded(self, frame, acq_time):
+        # packed frames are copied into the padded rows of the slot plane by plane,
+        # the way begin_frame hands them out
+        image_format = _lib.block_image_format(self._block)
+        dtype = _ELEMENT_DTYPES[image_format.element_type]
+        plane_sizes = [image_format.planes[i].width * image_format.planes[i].height
+                       * image_format.planes[i].channels * dtype.itemsize
+                       for i in range(image_format.plane_count)]
+        if frame.nbytes != sum(plane_sizes):
+            print(
+                "Error: frame size mismatch. Please ensure input frames are consistent.")
+            return False
+
+        data = _lib.begin_write_frame(self._block)
+        if not data:
+            if not _lib.block_is_alive(self._block):
+                print("Block is not active.")
+            return False
+        slot = np.ctypeslib.as_array(data, (image_format.size,))
+        planes = _image_arrays(slot, 0, image_format)
+        packed = frame.reshape(-1).view(np.uint8)
+        offset = 0
+        for plane, size in zip(planes if isinstance(planes, tuple) else (planes,),
+                               plane_sizes):
+            plane[...] = packed[offset:offset + size].view(dtype).reshape(plane.shape)
+            offset += size
+        return _lib.commit_write_frame(self._block, acq_time) == SUCCESS
+
+    def commit_frame(self, acq_time: np.uint64):
+        """Publishes the frame returned by `begin_frame`. `act_time` is the
+        time when the frame was acquired, in the unit of `timestamp_unit`.
+        """
+        exit_code = _lib.commit_write_frame(self._block, acq_time)
+        if exit_code == NO_FRAME_IN_PROGRESS:
+            print("Error: commit_frame called without begin_frame.")
+
+    def stats(self):
+        """Returns a dict with the counters of the block and a list of its
+        readers, see `block_stats_t`, or `None` before the first frame.
+        """
+        if self._block is None:
+            return None
+        return _block_stats(self._block)
+
+    def _dimensions(self, shape):
+        if self._options.pixel_format in (PIXEL_FORMAT_NV12, PIXEL_FORMAT_I420):
+            # OpenCV's layout stacks the chroma planes below the luma plane
+            rows, width = shape[:2]
+            return width, rows * 2 // 3, 1
         width = height = depth = 1
-        if len(frame.shape) == 1:
-            width = frame.shape[0]
-        elif len(frame.shape) == 2:
-            height, width = frame.shape
+        if len(shape) == 1:
+            width = shape[0]
+        elif len(shape) == 2:
+            height, width = shape
         else:
-            height, width, depth = frame.shape
+            height, width, depth = shape
+        return width, height, depth
 
+    def _create_block(self, width, height, depth, dtype=None):
         if self._block is None:
+            if dtype is not None and not self._explicit_format:
+                if dtype not in _PIXEL_FORMATS:
+                    raise TypeError(f"frames of type {dtype} are not supported")
+                self._options.pixel_format = _PIXEL_FORMATS[dtype]
+            self._block_shape = (width, height, depth)
             c_name = self.name.encode("utf-8")
-            self._block = _lib.create_block(
-                c_name, width, height, depth)
+            self._block = _lib.create_block_ex(
+                c_name, width, height, depth, addressof(self._options))
             if self._block is None and _lib.cstr_block_is_poisoned(c_name):
-                tmp_block = _lib.open_block(c_name)
-                _lib.destroy_block(tmp_block)
-                time.sleep(1)
-                self._block = _lib.create_block(
-                    c_name, width, height, depth)
+                # take over the block of the writer that crashed, so that its readers
+                # stay attached. Only a block of another shape is recreated.
+                self._block = _lib.reclaim_block(c_name)
+                if self._block is not None and not self._block_fits(width, height, depth):
+                    _lib.destroy_block(self._block)
+                    self._block = _lib.create_block_ex(
+                        c_name, width, height, depth, addressof(self._options))
             if self._block is None:
                 raise ExistentialError()
 
-        exit_code = _lib.write_frame(
-            self._block, width, height, depth, acq_time, frame.ctypes.data)
-
-        if exit_code == FRAME_SIZE_MISMATCH:
-            print(
-                "Error: frame size mismatch. Please ensure input frames are consistent.")
-        elif exit_code == BLOCK_NOT_ACTIVE:
-            print("Block is not active.")
+    def _block_fits(self, width, height, depth):
+        stats = _block_stats(self._block)
+        return ((stats["width"], stats["height"], stats["depth"]) == (width, height, depth)
+                and _lib.block_image_format(self._block).pixel_format
+                == self._options.pixel_format)
 
     def __del__(self):
         # free memory to prevent memory leaks
@@ -151,63 +702,352 @@ class BufferedFrameWriter:
             _lib.destroy_block(self._block)
 
 
-class BufferedFrameReader:
+class BufferedFrameProducer(BufferedFrameWriter):
     def __init__(self, name: str):
-        """Attempts to open the buffer called `name`
+        """Opens the buffer called `name`, created by a `BufferedFrameWriter`
+        with `multi_producer=True`, to write frames to it alongside its writer.
+        Frames are written exactly like with `BufferedFrameWriter`; every thread
+        opens its own producer.
+        """
+        self.name = name
+        self._block = _lib.open_block_producer(name.encode("utf-8"))
+        if self._block is None:
+            raise ExistentialError()
+        stats = _block_stats(self._block)
+        self._block_shape = (stats["width"], stats["height"], stats["depth"])
+        self._options = _lib.default_block_options()
+        self._options.pixel_format = _lib.block_image_format(self._block).pixel_format
+        if _lib.block_payload_capacity(self._block) != _lib.block_image_size(self._block):
+            self._options.max_payload_size = _lib.block_payload_capacity(self._block)
+        self._explicit_format = True
+        self._image_size = None
+
+    def __del__(self):
+        if self._block != None:
+            _lib.close_block(self._block)
+
+
+class BufferedFrameReader:
+    def __init__(self, name: str, reliable: bool = None, level: int = 0,
+                 spin_ns: int = 0, spin_yield: bool = False, cpu: int = None):
+        """Attempts to open the buffer called `name`. If `reliable` is given,
+        the reader registers its position with the writer: a reliable reader
+        receives every frame unless the writer overwrites frames
+        (`BACKPRESSURE_OVERWRITE`), a best-effort one never holds the writer
+        back. A `level` other than 0 reads one of the levels the writer
+        derives from every frame, see `BufferedFrameWriter`.
+
+        Blocking reads poll the buffer for up to `spin_ns` nanoseconds before
+        they go to sleep, which saves the wakeup latency of a sleeping reader at
+        the cost of a busy core (see `set_wait_policy` in buffer.h).
+        `spin_yield` gives up the core between polls, and `cpu` pins the
+        calling thread to that CPU.
         """
         self.name = name
-        self._frame = self._setup_accessor_frame()
+        self.reliable = reliable
+        self.level = level
+        self._wait_policy = _WaitPolicy(spin_ns, spin_yield, -1 if cpu is None else cpu)
+        self._frame = None
+        self._view = _FrameView()
         self._last_python_frame = None
         self._array = None
+        self._storage = None
+        self._window = None
         self._block = None
         self._attach_to_block()
 
     def _attach_to_block(self, show_found_msg=False):
+        # short waits keep the loop interruptible, the block is still opened as soon
+        # as it is created
+        self._block = _lib.wait_for_block(self.name.encode("utf-8"), self.level, 0)
+        if self._block is None:
+            print(f"Block {self.name} dne. Waiting for it.")
+            show_found_msg = True
         while self._block is None:
-            self._block = _lib.open_block(self.name.encode("utf-8"))
-            if self._block is None:
-                print(f"Block {self.name} dne. Waiting and trying again.")
-                show_found_msg = True
-                time.sleep(3)
+            self._block = _lib.wait_for_block(
+                self.name.encode("utf-8"), self.level, 100)
         if show_found_msg:
             print(f"Found {self.name}!!!")
+        if self.reliable is not None and \
+                _lib.register_reader(self._block, self.reliable) != SUCCESS:
+            raise ExistentialError()
+        if (self._wait_policy.spin_ns or self._wait_policy.cpu != -1) and \
+                not _lib.set_wait_policy(self._block, addressof(self._wait_policy)):
+            print(f"Could not pin the reader of {self.name} to CPU {self._wait_policy.cpu}.")
+        self._reserve_frame()
 
-    def _setup_accessor_frame(self):
-        frame = _Frame()
-        frame.frame_uid = np.uint64(0)
-        return frame
+    def _reserve_frame(self):
+        # frames are read straight into numpy owned memory that is sized for the
+        # block once, so the steady-state read path never allocates
+        image_size = _lib.block_payload_capacity(self._block)
+        if self._storage is not None and self._storage.size >= image_size:
+            return
+        self._storage = np.empty(image_size, dtype=np.ubyte)
+        self._array = None
+        frame_uid = 0 if self._frame is None else self._frame.frame_uid
+        self._frame = _framebuffer.Frame(self._storage)
+        self._frame.frame_uid = frame_uid
 
-    def get_next_frame(self, wait_for_frame=True):
+    def get_next_frame(self, wait_for_frame=True, zero_copy=False,
+                       conversion=None, scale=1, roi=None, spin_ns=None):
         """ Returns a pair. The first value is the frame data. The second value
         is the time that frame was acquired. 
 
         This function blocks when `wait_for_frame` is True. If `wait_for_frame`
         is set to False, and there is no new frame ready in the buffer, 
         this function returns `None`
+
+        If `zero_copy` is True, the frame data is a read-only view straight
+        into the shared buffer instead of a copy. The view keeps its slot locked
+        and is only valid until the next call to `get_next_frame` or
+        `release_frame`, so release it as soon as possible. For lock-free
+        blocks the writer may overwrite the view at any time, which
+        `release_frame` reports.
+
+        Encoded frames (see `get_next_packet`) are returned as flat arrays of
+        their payload bytes. Frames are `(height, width, depth)` arrays of the
+        block's element type, or a tuple of one array per plane for NV12 and
+        I420.
+
+        Pass one of the `CONVERT_*` values as `conversion`, and/or a `scale` of
+        2 or 4, to receive the frame colour converted and box downscaled
+        instead, e.g. `conversion=CONVERT_BGR_TO_RGB, scale=2` in place of
+        `cv2.cvtColor` and `cv2.resize`. The conversion happens while the frame
+        is copied out of the buffer, which saves a pass over the frame. Only
+        uint8 blocks support it.
+
+        Pass `roi=(x, y, width, height)` to only read that region of the frame.
+        With `zero_copy`, the region is a strided view into the buffer instead.
+
+        `spin_ns` changes how long this and later blocking reads poll for the
+        frame before they sleep, see `BufferedFrameReader`.
         """
-        curr_frame = self._frame
+        if spin_ns is not None and spin_ns != self._wait_policy.spin_ns:
+            self._wait_policy.spin_ns = spin_ns
+            # the thread was pinned when the reader was created, if at all
+            policy = _WaitPolicy(spin_ns, self._wait_policy.yield_, -1)
+            _lib.set_wait_policy(self._block, addressof(policy))
+        self.release_frame()
+        convert = conversion is not None or scale != 1
+        if convert and roi is not None:
+            raise ValueError("regions of frames cannot be converted")
+        if zero_copy:
+            if convert:
+                raise ValueError("converted frames cannot be zero-copy")
+            return self._get_next_frame_view(wait_for_frame, roi)
 
-        exit_code = _lib.read_frame(
-            self._block, addressof(curr_frame), wait_for_frame)
+        while True:
+            curr_frame = self._frame
+            if roi is not None:
+                exit_code = _framebuffer.read_frame_roi(
+                    self._block, curr_frame, *roi, wait_for_frame)
+            elif convert:
+                exit_code = _framebuffer.read_frame_converted(
+                    self._block, curr_frame,
+                    CONVERT_COPY if conversion is None else conversion, scale,
+                    wait_for_frame)
+            else:
+                exit_code = _framebuffer.read_frame(
+                    self._block, curr_frame, wait_for_frame)
+            if exit_code != BLOCK_NOT_ACTIVE:
+                break
+            self._reattach_to_block()
 
-        if exit_code == BLOCK_NOT_ACTIVE:
-            print(f"Lost access to {self.name}. Retrying open.")
-            self._block = None
-            self._attach_to_block(True)
-            return self.get_next_frame()
+        if exit_code == CONVERSION_NOT_SUPPORTED:
+            raise ValueError(
+                f"frames of {self.name} cannot be converted that way")
+        elif exit_code == INVALID_REGION:
+            raise ValueError(f"{roi} is not a region of the frames of {self.name}")
         elif exit_code == FRAME_SIZE_MISMATCH:
             pass  # never be here.
         elif exit_code == NO_NEW_FRAME:
             return None
-        shape = (curr_frame.height, curr_frame.width, curr_frame.depth)
-
-        if (self._array is None or
-                self._array.__array_interface__['data'][0] != addressof(curr_frame.data.contents)):
-            self._array = np.ctypeslib.as_array(curr_frame.data, shape)
+        layout = (curr_frame.codec, curr_frame.payload_size,
+                  curr_frame.format.pixel_format, curr_frame.width,
+                  curr_frame.height, curr_frame.depth, curr_frame.format.size)
+        if self._array is None or self._array_layout != layout:
+            if curr_frame.codec != CODEC_RAW:
+                self._array = self._storage[:curr_frame.payload_size]
+            else:
+                self._array = _image_arrays(
+                    self._storage, 0, curr_frame.format)
+            self._array_layout = layout
 
         self._last_python_frame = self._array, curr_frame.acquisition_time
         return self._last_python_frame
 
+    def get_next_packet(self, wait_for_frame=True):
+        """Returns a triple for the next encoded frame. The first value is a
+        uint8 array holding the payload, the second the codec tag, the third
+        the time the frame was acquired. The array is reused by the next read.
+        Returns `None` like `get_next_frame` does.
+        """
+        result = self.get_next_frame(wait_for_frame)
+        if result is None:
+            return None
+        payload = self._storage[:self._frame.payload_size]
+        return payload, self._frame.codec, self._frame.acquisition_time
+
+    def notify_fd(self):
+        """Returns a file descriptor that becomes readable when a new frame is
+        available, for use with `select`/`epoll` across many readers. Drain it
+        by calling `get_next_frame(wait_for_frame=False)` until it returns
+        `None`. The descriptor changes when the reader reattaches to a
+        restarted writer.
+        """
+        fd = _lib.block_notify_fd(self._block)
+        if fd == -1:
+            raise ExistentialError()
+        return fd
+
+    async def get_next_frame_async(self, zero_copy=False):
+        """Awaitable version of `get_next_frame`. The event loop waits on the
+        block's notification descriptor instead of blocking a thread, so one
+        thread can consume many blocks.
+
+            async def consume(reader):
+                while True:
+                    frame, acq_time = await reader.get_next_frame_async()
+                    ...
+
+            await asyncio.gather(consume(forward), consume(down))
+        """
+        loop = asyncio.get_running_loop()
+        while True:
+            fd = self.notify_fd()
+            result = self.get_next_frame(False, zero_copy)
+            if result is not None:
+                return result
+
+            ready = loop.create_future()
+            loop.add_reader(fd, lambda: ready.done() or ready.set_result(None))
+            try:
+                await ready
+            finally:
+                loop.remove_reader(fd)
+
+    def get_next_frames(self, n, wait_for_frame=True):
+        """Returns a pair for the up to `n` consecutive frames that end with
+        the newest frame in the buffer. The first value is a stacked
+        `(count, height, width, depth)` array, oldest frame first. The second
+        value is an array holding the acquisition time of each frame. `count`
+        is less than `n` while the buffer does not hold `n` frames; keep it
+        at most the writer's `slot_count`.
+
+        The frames are read in one consistent pass, so they never skip over a
+        frame in between. A new window is returned once the newest frame
+        has changed, which means consecutive windows usually overlap.
+
+        This function blocks when `wait_for_frame` is True. If `wait_for_frame`
+        is set to False, and there is no new frame ready in the buffer,
+        this function returns `None`
+        """
+        count = c_ssize_t(0)
+        while True:
+            self._reserve_window(n)
+            exit_code = _lib.read_frames(
+                self._block, addressof(self._window), n, count, wait_for_frame)
+            if exit_code != BLOCK_NOT_ACTIVE:
+                break
+            self._reattach_to_block()
+
+        if exit_code == NO_NEW_FRAME:
+            return None
+
+        count = count.value
+        frames = _image_arrays(self._window_storage, 0, self._window[0].format,
+                               count, self._window_storage.strides[0])
+        times = np.array([self._window[i].acquisition_time for i in range(count)],
+                         dtype=np.uint64)
+        return frames, times
+
+    def _reserve_window(self, n):
+        # one (n, image_size) array backs every frame of the window, so the frames
+        # need no stacking copy afterwards
+        image_size = _lib.block_payload_capacity(self._block)
+        if (self._window is not None and len(self._window) == n and
+                self._window_storage.shape[1] == image_size):
+            return
+        self._window = (_Frame * n)()
+        self._window_storage = np.empty((n, image_size), dtype=np.ubyte)
+        for i in range(n):
+            self._window[i].data = self._window_storage[i].ctypes.data_as(
+                POINTER(c_ubyte))
+            self._window[i].capacity = image_size
+            self._window[i].storage = FRAME_STORAGE_CALLER
+
+    def _get_next_frame_view(self, wait_for_frame, roi=None):
+        while True:
+            view = self._view
+            # copying and zero-copy reads share one position in the stream
+            view.frame_uid = self._frame.frame_uid
+            if roi is not None:
+                exit_code = _lib.acquire_frame_view_roi(
+                    self._block, addressof(view), *roi, wait_for_frame)
+            else:
+                exit_code = _lib.acquire_frame_view(
+                    self._block, addressof(view), wait_for_frame)
+            if exit_code != BLOCK_NOT_ACTIVE:
+                break
+            self._reattach_to_block()
+
+        if exit_code == INVALID_REGION:
+            raise ValueError(f"{roi} is not a region of the frames of {self.name}")
+        elif exit_code == NO_NEW_FRAME:
+            return None
+        return self._held_view_frame()
+
+    def _held_view_frame(self):
+        # the read-only arrays of the frame held in `_view`
+        view = self._view
+        self._frame.frame_uid = view.frame_uid
+
+        if view.codec != CODEC_RAW:
+            array = np.ctypeslib.as_array(view.data, (view.payload_size,))
+        else:
+            slot = np.ctypeslib.as_array(view.data, (view.format.size,))
+            array = _image_arrays(slot, 0, view.format)
+        for plane in array if isinstance(array, tuple) else (array,):
+            plane.flags.writeable = False
+
+        self._last_python_frame = array, view.acquisition_time
+        return self._last_python_frame
+
+    def release_frame(self):
+        """Releases the slot held by the last zero-copy frame. The array
+        returned by that call must not be used afterwards. Returns `False` if
+        the writer overwrote the frame while it was held (lock-free blocks
+        only), in which case any result computed from it should be dropped.
+        """
+        intact = True
+        if self._block is not None and self._view.data:
+            exit_code = _lib.release_frame_view(
+                self._block, addressof(self._view))
+            intact = exit_code != FRAME_OVERWRITTEN
+            # the last frame pointed into the released slot
+            self._last_python_frame = None
+        return intact
+
+    def _reattach_to_block(self):
+        print(f"Lost access to {self.name}. Retrying open.")
+        # the old handle still maps the buffer of the writer that is gone
+        self.release_frame()
+        _lib.close_block(self._block)
+        self._view = _FrameView()
+        # the new writer starts counting frames from the beginning
+        self._frame.frame_uid = 0
+        self._window = None
+        self._array = None
+        self._block = None
+        self._attach_to_block(True)
+
+    def stats(self):
+        """Returns a dict with the counters of the block and a list of its
+        readers, see `block_stats_t`. This reader is only listed once it read
+        a frame, and only if the writer collects stats.
+        """
+        return _block_stats(self._block)
+
     def has_last_frame(self):
         """Returns `True` if `get_next_frame()` successfully terminated once."""
         return self._last_python_frame is not None
@@ -221,4 +1061,39 @@ class BufferedFrameReader:
     def __del__(self):
         # free memory to prevent memory leaks
         if self._block != None:
+            self.release_frame()
             _lib.close_block(self._block)
+
+
+def read_synced(readers, tolerance_ns: int, wait_for_frame: bool = True):
+    """Returns one zero-copy `(frame, acq_time)` pair per reader of `readers`,
+    read from the newest frames of their blocks whose acquisition times are at
+    most `tolerance_ns` nanoseconds apart, e.g. the two images of a stereo pair.
+    Frames are only returned once. Returns `None` if `wait_for_frame` is False
+    and no new set is ready.
+
+    Every reader holds its frame like after `get_next_frame(zero_copy=True)`,
+    so release each of them with `release_frame`.
+    """
+    for reader in readers:
+        reader.release_frame()
+    while True:
+        blocks = (c_void_p * len(readers))(*[reader._block for reader in readers])
+        views = (_FrameView * len(readers))()
+        for view, reader in zip(views, readers):
+            view.frame_uid = reader._frame.frame_uid
+        exit_code = _lib.read_synced(
+            blocks, len(readers), tolerance_ns, views, wait_for_frame)
+        if exit_code != BLOCK_NOT_ACTIVE:
+            break
+        for reader in readers:
+            if not _lib.block_is_alive(reader._block):
+                reader._reattach_to_block()
+
+    if exit_code == NO_NEW_FRAME:
+        return None
+    frames = []
+    for view, reader in zip(views, readers):
+        reader._view = _FrameView.from_buffer_copy(view)
+        frames.append(reader._held_view_frame())
+    return frames
@@ -0,0 +1,382 @@
+// Look at buffer.h for in depth documentation
+// _framebuffer: the CPython extension behind the per-frame calls of accessor.py
+//
+// accessor.py keeps using ctypes for everything that happens once per block (creating,
+// opening, stats), but reads and writes frames through this module. Its functions take
+// the address of a block_t as returned by those ctypes bindings, and release the GIL
+// while they wait for a frame and copy it, so other Python threads keep running.
+//
+// A Frame holds a frame_t whose image is read into caller-supplied storage, e.g. a numpy
+// array sized with block_payload_capacity. The storage is never reallocated, so arrays
+// that point into it stay valid. Frames implement the buffer protocol: single plane
+// images are exported as (height, width, depth) arrays of their element type,
+// everything else as the flat payload bytes.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+
+#include "buffer.h"
+
+// clang-format off
+typedef struct {
+    PyObject_HEAD
+    frame_t frame;
+    Py_buffer storage;
+    bool busy;  // set while the GIL is released around a read into the frame
+    Py_ssize_t shape[3];
+    Py_ssize_t strides[3];
+} FrameObject;
+// clang-format on
+
+static PyTypeObject FrameType;
+
+static PyStructSequence_Field plane_fields[] = {
+    {"offset", NULL}, {"width", NULL}, {"height", NULL}, {"channels", NULL}, {"stride", NULL},
+    {NULL, NULL},
+};
+static PyStructSequence_Desc plane_desc = {"_framebuffer.Plane", "A plane_t.", plane_fields, 5};
+static PyTypeObject PlaneType;
+
+static PyStructSequence_Field format_fields[] = {
+    {"pixel_format", NULL}, {"element_type", NULL}, {"element_size", NULL},
+    {"plane_count", NULL},  {"planes", NULL},       {"size", NULL},
+    {NULL, NULL},
+};
+static PyStructSequence_Desc format_desc = {"_framebuffer.ImageFormat", "An image_format_t.",
+                                            format_fields, 6};
+static PyTypeObject ImageFormatType;
+
+static int frame_init(FrameObject* self, PyObject* args, PyObject* kwargs) {
+    static char* keywords[] = {"storage", NULL};
+    PyObject* storage;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", keywords, &storage)) return -1;
+    if (self->storage.obj != NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Frame is already initialized");
+        return -1;
+    }
+    if (PyObject_GetBuffer(storage, &self->storage, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS) == -1)
+        return -1;
+
+    self->frame = (frame_t){0};
+    self->frame.data = (image*)self->storage.buf;
+    self->frame.capacity = self->storage.len;
+    self->frame.storage = FRAME_STORAGE_CALLER;
+    return 0;
+}
+
+static void frame_dealloc(FrameObject* self) {
+    if (self->storage.obj != NULL) PyBuffer_Release(&self->storage);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+// Exports the image read last, see the top of this file. The storage stays locked by
+// the frame itself, so the exported memory never goes away before the export.
+static int frame_getbuffer(FrameObject* self, Py_buffer* view, int flags) {
+    if (self->storage.obj == NULL) {
+        PyErr_SetString(PyExc_BufferError, "Frame is not initialized");
+        return -1;
+    }
+    frame_t* frame = &self->frame;
+    const image_format_t* format = &frame->format;
+    const plane_t* plane = &format->planes[0];
+    bool shaped = frame->codec == CODEC_RAW && format->plane_count == 1 &&
+                  frame->payload_size == format->size;
+    static char* element_formats[] = {"B", "H", "f"};
+
+    view->obj = Py_NewRef(self);
+    view->readonly = 0;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    if (shaped) {
+        self->shape[0] = plane->height;
+        self->shape[1] = plane->width;
+        self->shape[2] = plane->channels;
+        self->strides[0] = plane->stride;
+        self->strides[1] = plane->channels * format->element_size;
+        self->strides[2] = format->element_size;
+        view->buf = frame->data + plane->offset;
+        view->itemsize = format->element_size;
+        view->len = plane->height * plane->width * plane->channels * format->element_size;
+        view->ndim = 3;
+        view->format = element_formats[format->element_type];
+    } else {
+        self->shape[0] = frame->payload_size;
+        self->strides[0] = 1;
+        view->buf = frame->data;
+        view->itemsize = 1;
+        view->len = frame->payload_size;
+        view->ndim = 1;
+        view->format = "B";
+    }
+    if (!(flags & PyBUF_FORMAT)) view->format = NULL;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) ? self->strides : NULL;
+    if (shaped && view->strides == NULL &&
+        plane->stride != plane->width * plane->channels * format->element_size) {
+        Py_CLEAR(view->obj);
+        PyErr_SetString(PyExc_BufferError, "the rows of this frame are padded");
+        return -1;
+    }
+    return 0;
+}
+
+static PyBufferProcs frame_as_buffer = {(getbufferproc)frame_getbuffer, NULL};
+
+static PyObject* frame_get_format(FrameObject* self, void* closure) {
+    const image_format_t* format = &self->frame.format;
+    PyObject* planes = PyTuple_New(format->plane_count);
+    if (planes == NULL) return NULL;
+    for (size_t i = 0; i < format->plane_count; i++) {
+        const plane_t* plane = &format->planes[i];
+        PyObject* item = PyStructSequence_New(&PlaneType);
+        if (item == NULL) {
+            Py_DECREF(planes);
+            return NULL;
+        }
+        PyStructSequence_SET_ITEM(item, 0, PyLong_FromSize_t(plane->offset));
+        PyStructSequence_SET_ITEM(item, 1, PyLong_FromSize_t(plane->width));
+        PyStructSequence_SET_ITEM(item, 2, PyLong_FromSize_t(plane->height));
+        PyStructSequence_SET_ITEM(item, 3, PyLong_FromSize_t(plane->channels));
+        PyStructSequence_SET_ITEM(item, 4, PyLong_FromSize_t(plane->stride));
+        PyTuple_SET_ITEM(planes, i, item);
+    }
+    PyObject* result = PyStructSequence_New(&ImageFormatType);
+    if (result == NULL) {
+        Py_DECREF(planes);
+        return NULL;
+    }
+    PyStructSequence_SET_ITEM(result, 0, PyLong_FromLong(format->pixel_format));
+    PyStructSequence_SET_ITEM(result, 1, PyLong_FromLong(format->element_type));
+    PyStructSequence_SET_ITEM(result, 2, PyLong_FromSize_t(format->element_size));
+    PyStructSequence_SET_ITEM(result, 3, PyLong_FromSize_t(format->plane_count));
+    PyStructSequence_SET_ITEM(result, 4, planes);
+    PyStructSequence_SET_ITEM(result, 5, PyLong_FromSize_t(format->size));
+    return result;
+}
+
+static PyObject* frame_get_pixel_format(FrameObject* self, void* closure) {
+    return PyLong_FromLong(self->frame.format.pixel_format);
+}
+
+static PyObject* frame_get_image_size(FrameObject* self, void* closure) {
+    return PyLong_FromSize_t(self->frame.format.size);
+}
+
+static PyGetSetDef frame_getset[] = {
+    {"format", (getter)frame_get_format, NULL, "the image_format_t of the frame", NULL},
+    {"pixel_format", (getter)frame_get_pixel_format, NULL, "format.pixel_format", NULL},
+    {"image_size", (getter)frame_get_image_size, NULL, "format.size", NULL},
+    {NULL},
+};
+
+#define FRAME_MEMBER(name, type, flags) \
+    {#name, type, offsetof(FrameObject, frame) + offsetof(frame_t, name), flags, NULL}
+
+static PyMemberDef frame_members[] = {
+    FRAME_MEMBER(width, T_PYSSIZET, READONLY),
+    FRAME_MEMBER(height, T_PYSSIZET, READONLY),
+    FRAME_MEMBER(depth, T_PYSSIZET, READONLY),
+    FRAME_MEMBER(acquisition_time, T_ULONGLONG, READONLY),
+    // readers reset it to read from the beginning of a new writer's stream
+    FRAME_MEMBER(frame_uid, T_ULONGLONG, 0),
+    FRAME_MEMBER(capacity, T_PYSSIZET, READONLY),
+    FRAME_MEMBER(payload_size, T_PYSSIZET, READONLY),
+    FRAME_MEMBER(codec, T_UINT, READONLY),
+    {NULL},
+};
+
+static PyTypeObject FrameType = {
+    PyVarObject_HEAD_INIT(NULL, 0).tp_name = "_framebuffer.Frame",
+    .tp_doc = PyDoc_STR("Frame(storage): a frame_t that is read into the writable buffer "
+                        "[storage]"),
+    .tp_basicsize = sizeof(FrameObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)frame_init,
+    .tp_dealloc = (destructor)frame_dealloc,
+    .tp_members = frame_members,
+    .tp_getset = frame_getset,
+    .tp_as_buffer = &frame_as_buffer,
+};
+
+// Parses argument [index] of [args] as the address of a block_t.
+static block_t* block_argument(PyObject* const* args, Py_ssize_t index) {
+    block_t* block = (block_t*)PyLong_AsVoidPtr(args[index]);
+    if (block == NULL && !PyErr_Occurred())
+        PyErr_SetString(PyExc_ValueError, "the block is NULL");
+    return block;
+}
+
+// Marks the Frame [object] as busy for a read, so that no other thread reads into it
+// while the GIL is released. Returns NULL if it is not a Frame or it is busy already.
+static FrameObject* claim_frame(PyObject* object) {
+    if (!PyObject_TypeCheck(object, &FrameType)) {
+        PyErr_SetString(PyExc_TypeError, "expected a Frame");
+        return NULL;
+    }
+    FrameObject* frame = (FrameObject*)object;
+    if (frame->storage.obj == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Frame is not initialized");
+        return NULL;
+    }
+    if (frame->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "another thread is reading into this Frame");
+        return NULL;
+    }
+    frame->busy = true;
+    return frame;
+}
+
+static bool check_argument_count(const char* name, Py_ssize_t nargs, Py_ssize_t expected) {
+    if (nargs == expected) return true;
+    PyErr_Format(PyExc_TypeError, "%s() takes %zd arguments (%zd given)", name, expected, nargs);
+    return false;
+}
+
+// the macros that release and take back the GIL are statements of their own
+// clang-format off
+// read_frame(block, frame, wait) -> int, see [read_frame]
+static PyObject* py_read_frame(PyObject* module, PyObject* const* args, Py_ssize_t nargs) {
+    if (!check_argument_count("read_frame", nargs, 3)) return NULL;
+    block_t* block = block_argument(args, 0);
+    int wait = PyObject_IsTrue(args[2]);
+    if (block == NULL || wait == -1) return NULL;
+    FrameObject* frame = claim_frame(args[1]);
+    if (frame == NULL) return NULL;
+
+    int exit_code;
+    Py_BEGIN_ALLOW_THREADS
+    exit_code = read_frame(block, &frame->frame, wait);
+    Py_END_ALLOW_THREADS
+    frame->busy = false;
+    return PyLong_FromLong(exit_code);
+}
+
+// read_frame_converted(block, frame, conversion, scale, wait) -> int, see
+// [read_frame_converted]
+static PyObject* py_read_frame_converted(PyObject* module, PyObject* const* args,
+                                         Py_ssize_t nargs) {
+    if (!check_argument_count("read_frame_converted", nargs, 5)) return NULL;
+    block_t* block = block_argument(args, 0);
+    if (block == NULL) return NULL;
+    int conversion = PyLong_AsLong(args[2]);
+    size_t scale = PyLong_AsSize_t(args[3]);
+    int wait = PyObject_IsTrue(args[4]);
+    if (PyErr_Occurred() || wait == -1) return NULL;
+    FrameObject* frame = claim_frame(args[1]);
+    if (frame == NULL) return NULL;
+
+    int exit_code;
+    Py_BEGIN_ALLOW_THREADS
+    exit_code = read_frame_converted(block, &frame->frame, conversion, scale, wait);
+    Py_END_ALLOW_THREADS
+    frame->busy = false;
+    return PyLong_FromLong(exit_code);
+}
+
+// read_frame_roi(block, frame, x, y, width, height, wait) -> int, see [read_frame_roi]
+static PyObject* py_read_frame_roi(PyObject* module, PyObject* const* args, Py_ssize_t nargs) {
+    if (!check_argument_count("read_frame_roi", nargs, 7)) return NULL;
+    block_t* block = block_argument(args, 0);
+    if (block == NULL) return NULL;
+    size_t region[4];
+    for (int i = 0; i < 4; i++) region[i] = PyLong_AsSize_t(args[2 + i]);
+    int wait = PyObject_IsTrue(args[6]);
+    if (PyErr_Occurred() || wait == -1) return NULL;
+    FrameObject* frame = claim_frame(args[1]);
+    if (frame == NULL) return NULL;
+
+    int exit_code;
+    Py_BEGIN_ALLOW_THREADS
+    exit_code = read_frame_roi(block, &frame->frame, region[0], region[1], region[2],
+                               region[3], wait);
+    Py_END_ALLOW_THREADS
+    frame->busy = false;
+    return PyLong_FromLong(exit_code);
+}
+
+// write_frame(block, width, height, depth, acquisition_time, data) -> int, see
+// [write_frame]. [data] is any C-contiguous buffer.
+static PyObject* py_write_frame(PyObject* module, PyObject* const* args, Py_ssize_t nargs) {
+    if (!check_argument_count("write_frame", nargs, 6)) return NULL;
+    block_t* block = block_argument(args, 0);
+    if (block == NULL) return NULL;
+    size_t width = PyLong_AsSize_t(args[1]);
+    size_t height = PyLong_AsSize_t(args[2]);
+    size_t depth = PyLong_AsSize_t(args[3]);
+    uint64_t acquisition_time = PyLong_AsUnsignedLongLong(args[4]);
+    if (PyErr_Occurred()) return NULL;
+    Py_buffer data;
+    if (PyObject_GetBuffer(args[5], &data, PyBUF_C_CONTIGUOUS) == -1) return NULL;
+    if ((size_t)data.len != block_image_size(block)) {
+        PyBuffer_Release(&data);
+        return PyLong_FromLong(FRAME_SIZE_MISMATCH);
+    }
+
+    int exit_code;
+    Py_BEGIN_ALLOW_THREADS
+    exit_code = write_frame(block, width, height, depth, acquisition_time, (image*)data.buf);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&data);
+    return PyLong_FromLong(exit_code);
+}
+
+// write_packet(block, data, codec, acquisition_time) -> int, see [write_packet]. [data]
+// is any C-contiguous buffer.
+static PyObject* py_write_packet(PyObject* module, PyObject* const* args, Py_ssize_t nargs) {
+    if (!check_argument_count("write_packet", nargs, 4)) return NULL;
+    block_t* block = block_argument(args, 0);
+    if (block == NULL) return NULL;
+    uint32_t codec = PyLong_AsUnsignedLong(args[2]);
+    uint64_t acquisition_time = PyLong_AsUnsignedLongLong(args[3]);
+    if (PyErr_Occurred()) return NULL;
+    Py_buffer data;
+    if (PyObject_GetBuffer(args[1], &data, PyBUF_C_CONTIGUOUS) == -1) return NULL;
+
+    int exit_code;
+    Py_BEGIN_ALLOW_THREADS
+    exit_code = write_packet(block, data.buf, data.len, codec, acquisition_time);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&data);
+    return PyLong_FromLong(exit_code);
+}
+// clang-format on
+
+static PyMethodDef module_methods[] = {
+    {"read_frame", (PyCFunction)(void (*)(void))py_read_frame, METH_FASTCALL,
+     "read_frame(block, frame, wait) -> exit code"},
+    {"read_frame_converted", (PyCFunction)(void (*)(void))py_read_frame_converted,
+     METH_FASTCALL, "read_frame_converted(block, frame, conversion, scale, wait) -> exit code"},
+    {"read_frame_roi", (PyCFunction)(void (*)(void))py_read_frame_roi, METH_FASTCALL,
+     "read_frame_roi(block, frame, x, y, width, height, wait) -> exit code"},
+    {"write_frame", (PyCFunction)(void (*)(void))py_write_frame, METH_FASTCALL,
+     "write_frame(block, width, height, depth, acquisition_time, data) -> exit code"},
+    {"write_packet", (PyCFunction)(void (*)(void))py_write_packet, METH_FASTCALL,
+     "write_packet(block, data, codec, acquisition_time) -> exit code"},
+    {NULL, NULL, 0, NULL},
+};
+
+static struct PyModuleDef module_def = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "_framebuffer",
+    .m_doc = "Per-frame reads and writes of buffer.h that release the GIL.",
+    .m_size = -1,
+    .m_methods = module_methods,
+};
+
+PyMODINIT_FUNC PyInit__framebuffer(void) {
+    if (PyType_Ready(&FrameType) < 0) return NULL;
+    if (PlaneType.tp_name == NULL && PyStructSequence_InitType2(&PlaneType, &plane_desc) < 0)
+        return NULL;
+    if (ImageFormatType.tp_name == NULL &&
+        PyStructSequence_InitType2(&ImageFormatType, &format_desc) < 0)
+        return NULL;
+
+    PyObject* module = PyModule_Create(&module_def);
+    if (module == NULL) return NULL;
+    if (PyModule_AddObjectRef(module, "Frame", (PyObject*)&FrameType) < 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
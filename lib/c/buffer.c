@@ -5,12 +5,26 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <pthread.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <linux/magic.h>
+#include <linux/mempolicy.h>
+#include <poll.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
 #define max(a, b) \
@@ -18,40 +32,979 @@
        __typeof__ (b) _b = (b); \
      _a > _b ? _a : _b; })
 
+#define min(a, b) \
+    ({ __typeof__ (a) _a = (a); \
+       __typeof__ (b) _b = (b); \
+     _a < _b ? _a : _b; })
+
+// rounds [n] up to the next multiple of [alignment]
+#define round_up(n, alignment) (((n) + (alignment) - 1) / (alignment) * (alignment))
+
+// Fields that are written by different parties are kept on separate cache lines, so that
+// e.g. readers registering as waiters do not invalidate the line the writer publishes
+// frames on.
+#define CACHE_LINE 64
+
+// [BUFFER_MAGIC] and [BUFFER_LAYOUT_VERSION] open every buffer. The version has to be
+// bumped whenever the layout of buffer_t (or anything it contains) changes, so that
+// processes built against different layouts refuse to share a buffer.
+#define BUFFER_MAGIC 0x46554246u  // "FBUF" in memory
+#define BUFFER_LAYOUT_VERSION 9u
+
+// In SYNC_SEQLOCK mode [seq] is odd while the slot is being written. Readers copy the
+// slot optimistically and retry if [seq] changed in the meantime, which is why
+// [frame_uid], [acquisition_time] and the payload description are accessed atomically.
+// In SYNC_RWLOCK mode the slot is guarded by [lock], see [SLOT_WRITER]. [committed_uid]
+// is the newest frame committed to the slot by any producer of a [multi_producer] block,
+// see [publish_frames].
 typedef struct frame_metadata {
-    uint64_t frame_uid;
-    uint64_t acquisition_time;
-    pthread_rwlock_t rwlock;
+    _Alignas(CACHE_LINE) _Atomic uint64_t frame_uid;
+    _Atomic uint64_t acquisition_time;
+    _Atomic uint64_t payload_size;  // bytes written to the slot's image
+    _Atomic uint32_t codec;
+    _Atomic uint64_t seq;
+    _Atomic uint32_t lock;
+    _Atomic uint64_t committed_uid;
 } frame_metadata_t;
 
+// SYNC_RWLOCK slots are guarded by a reader-writer lock that is a single futex word: the
+// number of readers that hold the slot, plus [SLOT_WRITER] while the writer does. Unlike a
+// pthread_rwlock_t it does not belong to a thread, so a writer that takes over from one
+// that crashed can release the slot its predecessor died holding (see [reclaim_block]).
+// The writer sets [SLOT_WRITER] first, which keeps new readers out, and then sleeps on the
+// word until the readers that still hold the slot are done. Readers never sleep on the
+// word, they wait for the frame signal like they do for new frames.
+#define SLOT_WRITER 0x80000000u
+
+// A reader slot is claimed by storing the reader's pid in [pid]. [notify_address] is the
+// abstract unix socket address the reader receives notifications on, it is only valid
+// while [notify] is set. [cursor] is the newest frame the reader is done with, which the
+// writer waits for if [reliable] is set. [cursor] and the counters are only written by the
+// reader that owns the slot, the counters only if the buffer collects stats (see
+// reader_stats_t).
+typedef struct reader_slot {
+    _Alignas(CACHE_LINE) _Atomic pid_t pid;
+    _Atomic bool notify;
+    _Atomic bool reliable;
+    char notify_address[sizeof(((struct sockaddr_un*)0)->sun_path)];
+    socklen_t notify_address_len;
+
+    _Alignas(CACHE_LINE) _Atomic uint64_t cursor;
+    _Atomic uint64_t frames_read;
+    _Atomic uint64_t frames_skipped;
+    _Atomic uint64_t frame_wait_ns;
+    _Atomic uint64_t lock_wait_ns;
+    _Atomic uint64_t copy_ns;
+} reader_slot_t;
+
+// counters of the writer, only written if the buffer collects stats (see block_stats_t)
+typedef struct writer_stats {
+    _Alignas(CACHE_LINE) _Atomic uint64_t lock_wait_ns;
+    _Atomic uint64_t copy_ns;
+} writer_stats_t;
+
+// An image held by every slot. Level 0 is the image (or payload) written by the writer,
+// the others are derived from it with [conversion] and [scale] when the frame is
+// committed.
+typedef struct image_level {
+    size_t width, height, depth;
+    image_format_t format;
+    size_t offset;  // from the start of the slot
+    int conversion;
+    size_t scale;
+} image_level_t;
+
 typedef struct buffer {
-    uint64_t frame_cnt;  // ideally our modules never run long enough to overflow this count
+    uint32_t magic;           // [BUFFER_MAGIC]
+    uint32_t layout_version;  // [BUFFER_LAYOUT_VERSION]
+
+    // set up by the writer when the buffer is created, read-mostly afterwards
     size_t width, height, depth;
+    image_format_t format;  // layout of every image
+    size_t level_count;     // derived levels, stored in [levels] after level 0
+    image_level_t levels[MAX_DERIVED_LEVELS + 1];
+    size_t slot_count;    // number of images held in the buffer
+    size_t slot_size;     // bytes level 0 of a slot can hold: one image, or the max payload size
+    size_t image_offset;  // offset of the first image from the start of the buffer
+    size_t slot_stride;   // distance between the images of consecutive slots
+    int sync_mode;
+    int backpressure;
+    int timestamp_unit;   // one of the TIMESTAMP_* units of [acquisition_time]
+    bool multi_producer;  // whether frames are claimed through [ticket]
+    bool prefault;        // whether readers should prefault their mapping as well
+    bool stats;           // whether [writer_stats] and the reader counters are collected
     bool is_alive;
-    pid_t owner;
-    pthread_cond_t cond;
-    pthread_mutex_t cond_mutex;
-    frame_metadata_t metadata[BUFFER_COUNT];
-    image images[];
+    _Atomic pid_t owner;
+    _Atomic uint32_t generation;  // bumped when a writer reclaims the buffer
+
+    // written by the writer with every frame
+    _Alignas(CACHE_LINE) _Atomic uint64_t frame_cnt;  // ideally our modules never run long enough to overflow this count
+    _Atomic uint64_t frames_dropped;  // frames dropped because of BACKPRESSURE_SKIP
+    // the newest frame claimed by a producer of a [multi_producer] block. Frames up to
+    // here are being written, frames up to [frame_cnt] are published
+    _Atomic uint64_t ticket;
+    writer_stats_t writer_stats;
+
+    // readers sleep on [frame_signal] with futex(2). It is bumped every time a frame is
+    // committed or the block dies, and the writer only issues FUTEX_WAKE when
+    // [waiters] shows that someone is asleep.
+    _Alignas(CACHE_LINE) _Atomic uint32_t frame_signal;
+    _Atomic uint32_t waiters;
+
+    // a writer that waits for reliable readers (BACKPRESSURE_BLOCK) sleeps on
+    // [cursor_signal], which readers bump when they move their cursor while
+    // [writer_waiting] (the number of such writers) is not 0. [reliable_count] is the
+    // number of reliable readers.
+    _Alignas(CACHE_LINE) _Atomic uint32_t cursor_signal;
+    _Atomic uint32_t writer_waiting;
+    _Atomic uint32_t reliable_count;
+
+    // readers that asked for a notification file descriptor. The writer sends a datagram
+    // to every [notify_address] with every frame, as long as [notify_count] is non-zero.
+    _Alignas(CACHE_LINE) _Atomic uint32_t notify_count;
+    reader_slot_t readers[MAX_READERS];
+
+    // [slot_count] metadata entries, each on its own cache line(s), followed by
+    // [slot_count] images starting at [image_offset]. Use [slot_image] to locate the
+    // image of a slot.
+    frame_metadata_t metadata[];
 } buffer_t;
 
 typedef struct block {
     char* filename;
     buffer_t* buffer;
+    int pending_slot;  // slot locked by begin_write_frame, -1 if none
+    uint64_t pending_uid;  // frame_uid of the frame in [pending_slot]
+    bool producer;     // opened with open_block_producer, closed even by the owner
+    int reader_slot;   // slot in [buffer->readers] claimed by this reader, -1 if none
+    int notify_fd;     // socket that notifications are sent from/received on, -1 if none
+    size_t mapped_size;  // length of the mapping at [buffer]
+    size_t level;        // the level of every slot this block reads, see [open_block_level]
+    int adopted_slot;    // slot a crashed writer left locked, see [reclaim_block], -1 if none
+    int registry_entry;  // the writer's entry for the block in the registry, -1 if none
+    uint64_t rate_start_ns;     // start of the interval the writer measures its fps over
+    uint64_t rate_start_frame;  // [frame_cnt] at [rate_start_ns]
+    bool stats_unavailable;  // set once this reader failed to claim a slot for its counters
+    wait_policy_t wait_policy;  // see [set_wait_policy]
 } block_t;
 
 // helper functions to grab size in bytes for a particular data structure
 size_t buffer_image_size(const buffer_t* b) {
-    return b->width * b->height * b->depth;
+    return b->format.size;
 }
 size_t frame_image_size(const frame_t* f) {
-    return f->width * f->height * f->depth;
+    return f->format.size;
+}
+// images start on a page boundary, so that SIMD consumers and DMA get aligned data.
+// Each image is padded to whole pages, unless it is smaller than a page to begin with.
+size_t buffer_image_offset(size_t slot_count) {
+    return round_up(sizeof(buffer_t) + sizeof(frame_metadata_t) * slot_count,
+                    (size_t)sysconf(_SC_PAGESIZE));
+}
+size_t buffer_slot_stride(size_t image_size) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    return round_up(image_size, image_size < page_size ? CACHE_LINE : page_size);
+}
+size_t buffer_size(size_t slot_size, size_t slot_count) {
+    return buffer_image_offset(slot_count) + buffer_slot_stride(slot_size) * slot_count;
+}
+// the level of every slot [b] reads
+const image_level_t* block_level(const block_t* b) {
+    return &b->buffer->levels[b->level];
 }
-size_t buffer_size(size_t weight, size_t height, size_t depth) {
-    return sizeof(buffer_t) + (weight * height * depth * BUFFER_COUNT);
+// the payload size of [metadata], which cannot be trusted beyond the slot's bounds while
+// a SYNC_SEQLOCK slot is being overwritten
+size_t slot_payload_size(const buffer_t* b, frame_metadata_t* metadata) {
+    return min((size_t)atomic_load_explicit(&metadata->payload_size, memory_order_relaxed),
+               b->slot_size);
+}
+image* slot_image(buffer_t* b, size_t slot) {
+    return (image*)b + b->image_offset + b->slot_stride * slot;
+}
+// the image of [slot] at the level [block] reads, and its size
+const image* block_slot_image(block_t* block, size_t slot) {
+    return slot_image(block->buffer, slot) + block_level(block)->offset;
+}
+size_t block_slot_payload_size(block_t* block, frame_metadata_t* metadata) {
+    if (block->level == 0) return slot_payload_size(block->buffer, metadata);
+    return block_level(block)->format.size;
 }
 size_t block_image_size(const block_t* b) {
-    return buffer_image_size(b->buffer);
+    return block_level(b)->format.size;
+}
+size_t block_payload_capacity(const block_t* b) {
+    return b->level == 0 ? b->buffer->slot_size : block_image_size(b);
+}
+void* block_memory(const block_t* b, size_t* size) {
+    *size = b->mapped_size;
+    return b->buffer;
+}
+image_format_t block_image_format(const block_t* b) {
+    return block_level(b)->format;
+}
+size_t block_level_count(const block_t* b) {
+    return b->buffer->level_count;
+}
+
+// appends a plane of [width] * [height] pixels with [channels] channels to [format].
+// Returns false if the plane does not fit into a size_t.
+bool add_plane(image_format_t* format, size_t width, size_t height, size_t channels,
+               size_t alignment) {
+    plane_t* plane = &format->planes[format->plane_count++];
+    size_t row, rows;
+    if (__builtin_mul_overflow(width, channels, &row) ||
+        __builtin_mul_overflow(row, format->element_size, &row) ||
+        __builtin_add_overflow(row, alignment - 1, &row) ||
+        __builtin_add_overflow(format->size, alignment - 1, &plane->offset))
+        return false;
+    plane->offset -= plane->offset % alignment;
+    plane->width = width;
+    plane->height = height;
+    plane->channels = channels;
+    plane->stride = row - row % alignment;
+    return !__builtin_mul_overflow(plane->stride, height, &rows) &&
+           !__builtin_add_overflow(plane->offset, rows, &format->size);
+}
+
+bool image_format_init(image_format_t* format, int pixel_format, size_t width,
+                       size_t height, size_t depth, size_t row_alignment) {
+    memset(format, 0, sizeof(image_format_t));
+    format->pixel_format = pixel_format;
+    size_t alignment = row_alignment ? row_alignment : 1;
+    size_t chroma_width = width / 2 + width % 2, chroma_height = height / 2 + height % 2;
+
+    bool fits;
+    switch (pixel_format) {
+        case PIXEL_FORMAT_U8:
+            format->element_type = ELEMENT_U8;
+            format->element_size = sizeof(uint8_t);
+            fits = add_plane(format, width, height, depth, alignment);
+            break;
+        case PIXEL_FORMAT_U16:
+            format->element_type = ELEMENT_U16;
+            format->element_size = sizeof(uint16_t);
+            fits = add_plane(format, width, height, depth, alignment);
+            break;
+        case PIXEL_FORMAT_F32:
+            format->element_type = ELEMENT_F32;
+            format->element_size = sizeof(float);
+            fits = add_plane(format, width, height, depth, alignment);
+            break;
+        case PIXEL_FORMAT_NV12:
+            format->element_type = ELEMENT_U8;
+            format->element_size = sizeof(uint8_t);
+            fits = add_plane(format, width, height, 1, alignment) &&
+                   add_plane(format, chroma_width, chroma_height, 2, alignment);
+            break;
+        case PIXEL_FORMAT_I420:
+            format->element_type = ELEMENT_U8;
+            format->element_size = sizeof(uint8_t);
+            fits = add_plane(format, width, height, 1, alignment) &&
+                   add_plane(format, chroma_width, chroma_height, 1, alignment) &&
+                   add_plane(format, chroma_width, chroma_height, 1, alignment);
+            break;
+        default:
+            fprintf(stderr, "Unknown pixel format %d.", pixel_format);
+            return false;
+    }
+    if (!fits) {
+        fprintf(stderr, "Images of %zu * %zu * %zu pixels are too large.", width, height, depth);
+        return false;
+    }
+    return true;
+}
+size_t block_slot_count(const block_t* b) {
+    return b->buffer->slot_count;
+}
+
+int block_timestamp_unit(const block_t* b) {
+    return b->buffer->timestamp_unit;
+}
+
+uint64_t frame_time_ns(const block_t* b, uint64_t acquisition_time) {
+    if (b->buffer->timestamp_unit == TIMESTAMP_NANOSECONDS) return acquisition_time;
+    return acquisition_time * 1000000ull;
+}
+
+// helpers to collect the counters of block_stats_t. [stats_time] only reads the clock if
+// [stats] is non-NULL, i.e. if the buffer collects stats at all.
+uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+uint64_t stats_time(const void* stats) {
+    return stats != NULL ? monotonic_ns() : 0;
+}
+#define stats_add(stats, counter, n) \
+    do { \
+        if ((stats) != NULL) \
+            atomic_fetch_add_explicit(&(stats)->counter, (n), memory_order_relaxed); \
+    } while (0)
+#define stats_add_time(stats, counter, start) stats_add(stats, counter, monotonic_ns() - (start))
+
+// Wakes up every reader that is waiting on [buffer]. The hot path is a single atomic
+// increment, the syscall is only made when there are waiters.
+void signal_watchers(buffer_t* buffer) {
+    // we take care to avoid the following scenario: read thread sees that
+    //      no frame is available -> signal -> read thread sleeps -> misses out on frame
+    // the read thread registers as a waiter before it sleeps, and FUTEX_WAIT refuses to
+    // sleep once the signal has moved on.
+    atomic_fetch_add(&buffer->frame_signal, 1);
+    if (atomic_load(&buffer->waiters) > 0)
+        syscall(SYS_futex, &buffer->frame_signal, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Wakes up the writer of [buffer] if it waits for a reliable reader to move its cursor.
+void wake_writer(buffer_t* buffer) {
+    atomic_fetch_add(&buffer->cursor_signal, 1);
+    syscall(SYS_futex, &buffer->cursor_signal, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Drops the registrations of [reader], whose process closed its block or died. Freeing
+// the slot itself is up to the caller.
+void clear_reader_slot(buffer_t* buffer, reader_slot_t* reader) {
+    if (atomic_exchange(&reader->notify, false)) atomic_fetch_sub(&buffer->notify_count, 1);
+    if (atomic_exchange(&reader->reliable, false)) {
+        atomic_fetch_sub(&buffer->reliable_count, 1);
+        wake_writer(buffer);
+    }
+}
+
+// Sends a notification datagram to every reader of [block] that asked for one. The
+// datagrams only carry readiness, so a reader whose queue is full is simply skipped.
+void notify_readers(block_t* block) {
+    buffer_t* buffer = block->buffer;
+    if (atomic_load_explicit(&buffer->notify_count, memory_order_relaxed) == 0) return;
+
+    if (block->notify_fd == -1) {
+        block->notify_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (block->notify_fd == -1) return;
+    }
+
+    for (int i = 0; i < MAX_READERS; i++) {
+        reader_slot_t* reader = &buffer->readers[i];
+        if (!atomic_load_explicit(&reader->notify, memory_order_acquire)) continue;
+
+        struct sockaddr_un address = {.sun_family = AF_UNIX};
+        memcpy(address.sun_path, reader->notify_address, reader->notify_address_len);
+        socklen_t address_len = offsetof(struct sockaddr_un, sun_path) +
+                                reader->notify_address_len;
+        char notification = 0;
+        if (sendto(block->notify_fd, &notification, 1, MSG_DONTWAIT | MSG_NOSIGNAL,
+                   (struct sockaddr*)&address, address_len) == -1 &&
+            (errno == ECONNREFUSED || errno == ENOENT)) {
+            // nobody is bound to the address anymore, so the reader died without
+            // closing its block
+            if (atomic_load(&reader->notify)) {
+                clear_reader_slot(buffer, reader);
+                atomic_store(&reader->pid, 0);
+            }
+        }
+    }
+}
+
+// Discards all notifications that are waiting on [block]'s notification fd.
+void drain_notifications(block_t* block) {
+    char notifications[64];
+    while (recv(block->notify_fd, notifications, sizeof(notifications), MSG_DONTWAIT) > 0) {
+    }
+}
+
+// Claims a slot in [block]'s reader table for the current process. Returns the index of
+// the slot, or -1 if every slot is taken.
+int claim_reader_slot(block_t* block) {
+    if (block->reader_slot != -1) return block->reader_slot;
+
+    buffer_t* buffer = block->buffer;
+    for (int i = 0; i < MAX_READERS; i++) {
+        pid_t free_pid = 0;
+        reader_slot_t* reader = &buffer->readers[i];
+        // slots of readers that crashed are reclaimed as well
+        pid_t pid = atomic_load(&reader->pid);
+        if (pid != 0 && kill(pid, 0) != 0 && errno == ESRCH) {
+            clear_reader_slot(buffer, reader);
+            atomic_compare_exchange_strong(&reader->pid, &pid, 0);
+        }
+        if (atomic_compare_exchange_strong(&reader->pid, &free_pid, getpid())) {
+            atomic_store(&reader->cursor, atomic_load(&buffer->frame_cnt));
+            atomic_store(&reader->frames_read, 0);
+            atomic_store(&reader->frames_skipped, 0);
+            atomic_store(&reader->frame_wait_ns, 0);
+            atomic_store(&reader->lock_wait_ns, 0);
+            atomic_store(&reader->copy_ns, 0);
+            block->reader_slot = i;
+            return i;
+        }
+    }
+    fprintf(stderr, "All %d reader slots of %s are taken.", MAX_READERS, block->filename);
+    return -1;
+}
+
+// Returns the slot that the counters of [block]'s reader are collected in, claiming one
+// on first use. Returns NULL if the buffer does not collect stats or no slot is free.
+reader_slot_t* reader_stats(block_t* block) {
+    if (!block->buffer->stats) return NULL;
+    if (block->reader_slot == -1 && !block->stats_unavailable &&
+        claim_reader_slot(block) == -1)
+        block->stats_unavailable = true;
+    return block->reader_slot == -1 ? NULL : &block->buffer->readers[block->reader_slot];
+}
+
+// Returns the counters of [block]'s writer, or NULL if the buffer does not collect stats.
+writer_stats_t* writer_stats(block_t* block) {
+    return block->buffer->stats ? &block->buffer->writer_stats : NULL;
+}
+
+// Counts [count] frames read by [stats]' reader, the first of which is [first_uid]. Frames
+// between [last_uid], the frame the reader saw before, and [first_uid] were skipped.
+void count_frames_read(reader_slot_t* stats, uint64_t last_uid, uint64_t first_uid,
+                       size_t count) {
+    if (stats == NULL) return;
+    stats_add(stats, frames_read, count);
+    // a reader that just attached did not skip the frames before it
+    if (last_uid != 0 && first_uid > last_uid + 1)
+        stats_add(stats, frames_skipped, first_uid - last_uid - 1);
+}
+
+// Returns the reader slot of [block] to the reader table.
+void release_reader_slot(block_t* block) {
+    if (block->reader_slot == -1) return;
+
+    reader_slot_t* reader = &block->buffer->readers[block->reader_slot];
+    clear_reader_slot(block->buffer, reader);
+    atomic_store(&reader->pid, 0);
+    block->reader_slot = -1;
+}
+
+int register_reader(block_t* block, bool reliable) {
+    int slot = claim_reader_slot(block);
+    if (slot == -1) return NO_READER_SLOT;
+
+    buffer_t* buffer = block->buffer;
+    reader_slot_t* reader = &buffer->readers[slot];
+    // the writer must not overtake a new reliable reader before it catches up
+    atomic_store(&reader->cursor, max(atomic_load(&reader->cursor),
+                                      atomic_load(&buffer->frame_cnt)));
+    if (atomic_exchange(&reader->reliable, reliable) != reliable) {
+        if (reliable)
+            atomic_fetch_add(&buffer->reliable_count, 1);
+        else
+            atomic_fetch_sub(&buffer->reliable_count, 1);
+        wake_writer(buffer);
+    }
+    return SUCCESS;
+}
+
+bool set_wait_policy(block_t* block, const wait_policy_t* policy) {
+    block->wait_policy = *policy;
+    if (policy->cpu < 0) return true;
+
+    unsigned long cpumask[16] = {0};
+    size_t max_cpu = sizeof(cpumask) * CHAR_BIT;
+    if ((size_t)policy->cpu >= max_cpu) {
+        fprintf(stderr, "CPU %d is out of range.", policy->cpu);
+        return false;
+    }
+    cpumask[policy->cpu / (sizeof(unsigned long) * CHAR_BIT)] |=
+        1ul << (policy->cpu % (sizeof(unsigned long) * CHAR_BIT));
+    // a pid of 0 is the calling thread
+    if (syscall(SYS_sched_setaffinity, 0, sizeof(cpumask), cpumask) == -1) {
+        fprintf(stderr, "Failed to pin the reader to CPU %d: %s.", policy->cpu, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Moves the cursor of [block]'s reader to [frame_uid], the frame it is done with. A writer
+// waiting for a reliable reader is woken up.
+void advance_cursor(block_t* block, uint64_t frame_uid) {
+    if (block->reader_slot == -1) return;
+
+    buffer_t* buffer = block->buffer;
+    reader_slot_t* reader = &buffer->readers[block->reader_slot];
+    if (frame_uid <= atomic_load_explicit(&reader->cursor, memory_order_relaxed)) return;
+    if (!atomic_load_explicit(&reader->reliable, memory_order_relaxed)) {
+        atomic_store_explicit(&reader->cursor, frame_uid, memory_order_relaxed);
+        return;
+    }
+    // pairs with the writer announcing itself before it checks the cursors, so that
+    // either the writer sees the new cursor or the reader sees the waiting writer
+    atomic_store(&reader->cursor, frame_uid);
+    if (atomic_load(&buffer->writer_waiting)) wake_writer(buffer);
+}
+
+// Returns true if every reliable reader of [buffer] is done with frame [frame_uid].
+// Reliable readers that died are dropped along the way.
+bool reliable_readers_reached(buffer_t* buffer, uint64_t frame_uid) {
+    bool reached = true;
+    for (int i = 0; i < MAX_READERS; i++) {
+        reader_slot_t* reader = &buffer->readers[i];
+        if (!atomic_load(&reader->reliable) || atomic_load(&reader->cursor) >= frame_uid)
+            continue;
+        pid_t pid = atomic_load(&reader->pid);
+        if (kill(pid, 0) != 0 && errno == ESRCH) {
+            clear_reader_slot(buffer, reader);
+            continue;
+        }
+        reached = false;
+    }
+    return reached;
+}
+
+// Applies the back-pressure policy of [block] before frame [frame_uid] is written over the
+// slot of frame [frame_uid] - slot_count. Returns FRAME_DROPPED if the frame must not be
+// written.
+int make_room(block_t* block, uint64_t frame_uid) {
+    buffer_t* buffer = block->buffer;
+    if (buffer->backpressure == BACKPRESSURE_OVERWRITE || frame_uid <= buffer->slot_count ||
+        atomic_load(&buffer->reliable_count) == 0)
+        return SUCCESS;
+
+    uint64_t overwritten_uid = frame_uid - buffer->slot_count;
+    if (reliable_readers_reached(buffer, overwritten_uid)) return SUCCESS;
+    if (buffer->backpressure == BACKPRESSURE_SKIP) {
+        atomic_fetch_add_explicit(&buffer->frames_dropped, 1, memory_order_relaxed);
+        return FRAME_DROPPED;
+    }
+
+    writer_stats_t* stats = writer_stats(block);
+    uint64_t start = stats_time(stats);
+    // several producers of a [multi_producer] block may wait at the same time
+    atomic_fetch_add(&buffer->writer_waiting, 1);
+    while (true) {
+        uint32_t signal = atomic_load(&buffer->cursor_signal);
+        if (reliable_readers_reached(buffer, overwritten_uid)) break;
+        // readers that die without closing the block never wake us up
+        struct timespec timeout = {0, 100 * 1000 * 1000};
+        syscall(SYS_futex, &buffer->cursor_signal, FUTEX_WAIT, signal, &timeout, NULL, 0);
+    }
+    atomic_fetch_sub(&buffer->writer_waiting, 1);
+    stats_add_time(stats, lock_wait_ns, start);
+    return SUCCESS;
+}
+
+int block_notify_fd(block_t* block) {
+    if (block->notify_fd != -1) return block->notify_fd;
+
+    int slot = claim_reader_slot(block);
+    if (slot == -1) return -1;
+
+    int notify_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (notify_fd == -1) {
+        fprintf(stderr, "Failed to create a notification socket: %s.", strerror(errno));
+        return -1;
+    }
+
+    // binding only the address family autobinds the socket to a unique abstract address
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    socklen_t address_len = sizeof(address);
+    if (bind(notify_fd, (struct sockaddr*)&address, sizeof(sa_family_t)) == -1 ||
+        getsockname(notify_fd, (struct sockaddr*)&address, &address_len) == -1) {
+        fprintf(stderr, "Failed to bind a notification socket: %s.", strerror(errno));
+        close(notify_fd);
+        return -1;
+    }
+
+    reader_slot_t* reader = &block->buffer->readers[slot];
+    reader->notify_address_len = address_len - offsetof(struct sockaddr_un, sun_path);
+    memcpy(reader->notify_address, address.sun_path, reader->notify_address_len);
+    atomic_store_explicit(&reader->notify, true, memory_order_release);
+    atomic_fetch_add(&block->buffer->notify_count, 1);
+
+    block->notify_fd = notify_fd;
+    return notify_fd;
+}
+
+// Sleeps until [buffer]'s frame signal is no longer [signal].
+void wait_for_signal(buffer_t* buffer, uint32_t signal) {
+    atomic_fetch_add(&buffer->waiters, 1);
+    syscall(SYS_futex, &buffer->frame_signal, FUTEX_WAIT, signal, NULL, NULL, 0);
+    atomic_fetch_sub(&buffer->waiters, 1);
+}
+
+// Tells the core that it is in a spin loop, which hands its resources to the other
+// hyperthread and avoids the pipeline flush on the way out of the loop.
+void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+// Polls [block]'s frame signal while it is still [signal], for up to the [spin_ns] of the
+// block's wait policy. Returns true if the signal moved on, so that the reader does not
+// have to sleep on it with [wait_for_signal].
+bool spin_for_signal(block_t* block, uint32_t signal) {
+    const wait_policy_t* policy = &block->wait_policy;
+    if (policy->spin_ns == 0) return false;
+
+    buffer_t* buffer = block->buffer;
+    uint64_t deadline = monotonic_ns() + policy->spin_ns;
+    for (uint32_t polls = 1;; polls++) {
+        if (atomic_load_explicit(&buffer->frame_signal, memory_order_acquire) != signal)
+            return true;
+        // a poll is much cheaper than reading the clock, a yield is not
+        if ((policy->yield || polls % 64 == 0) && monotonic_ns() >= deadline) return false;
+        if (policy->yield)
+            sched_yield();
+        else
+            cpu_relax();
+    }
+}
+
+// Read-locks [metadata] unless the writer holds it. Returns false if it does.
+bool try_read_lock(frame_metadata_t* metadata) {
+    uint32_t state = atomic_load_explicit(&metadata->lock, memory_order_relaxed);
+    while (!(state & SLOT_WRITER)) {
+        if (atomic_compare_exchange_weak_explicit(&metadata->lock, &state, state + 1,
+                                                  memory_order_acquire, memory_order_relaxed))
+            return true;
+    }
+    return false;
+}
+
+void read_unlock(frame_metadata_t* metadata) {
+    // the last reader to leave wakes up the writer waiting for the slot
+    if (atomic_fetch_sub_explicit(&metadata->lock, 1, memory_order_release) == SLOT_WRITER + 1)
+        syscall(SYS_futex, &metadata->lock, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+// Waits until the readers that held [metadata] when SLOT_WRITER was set released it.
+void wait_for_slot_readers(frame_metadata_t* metadata) {
+    uint32_t state;
+    while ((state = atomic_load_explicit(&metadata->lock, memory_order_acquire)) != SLOT_WRITER)
+        syscall(SYS_futex, &metadata->lock, FUTEX_WAIT, state, NULL, NULL, 0);
+}
+
+// Write-locks [metadata]. Returns false if no reader held it, i.e. if it did not wait.
+bool write_lock(frame_metadata_t* metadata) {
+    if (atomic_fetch_or_explicit(&metadata->lock, SLOT_WRITER, memory_order_acquire) == 0)
+        return false;
+    wait_for_slot_readers(metadata);
+    return true;
+}
+
+void write_unlock(frame_metadata_t* metadata) {
+    atomic_fetch_and_explicit(&metadata->lock, ~SLOT_WRITER, memory_order_release);
+}
+
+// Waits until the slot of the claimed frame [frame_uid] of a [multi_producer] block no
+// longer holds an unpublished frame of another producer, i.e. until the frame one lap
+// ahead of it is published. Fails with BLOCK_NOT_ACTIVE if the block dies in the meantime.
+int wait_for_free_slot(block_t* block, uint64_t frame_uid) {
+    buffer_t* buffer = block->buffer;
+    while (true) {
+        uint32_t signal = atomic_load(&buffer->frame_signal);
+        if (atomic_load(&buffer->frame_cnt) + buffer->slot_count >= frame_uid) return SUCCESS;
+        if (!buffer->is_alive) return BLOCK_NOT_ACTIVE;
+        wait_for_signal(buffer, signal);
+    }
+}
+
+// Publishes the frames committed by the producers of a [multi_producer] block in the
+// order they were claimed in: [frame_cnt] moves past every consecutive frame that has been
+// committed, by whichever producer gets there first. A producer that commits ahead of an
+// earlier one leaves its frame to be published by that one. Returns true if any frame was
+// published.
+bool publish_frames(buffer_t* buffer) {
+    bool published = false;
+    uint64_t newest = atomic_load(&buffer->frame_cnt);
+    while (true) {
+        uint64_t next = newest + 1;
+        frame_metadata_t* metadata = &buffer->metadata[next % buffer->slot_count];
+        // both sides are sequentially consistent, so that a frame committed while its
+        // predecessor is published is seen by one of the two producers
+        if (atomic_load(&metadata->committed_uid) != next) return published;
+        if (atomic_compare_exchange_strong(&buffer->frame_cnt, &newest, next)) {
+            newest = next;
+            published = true;
+        }
+    }
+}
+
+// Does the work of [begin_write_frame], but reports why no frame can be written:
+// BLOCK_NOT_ACTIVE (or a frame in progress) or FRAME_DROPPED.
+int begin_write_slot(block_t* block, image** destination) {
+    buffer_t* buffer = block->buffer;
+
+    // assert precondition: block is active
+    if (!buffer->is_alive) return BLOCK_NOT_ACTIVE;
+
+    // assert precondition: no other write is in progress
+    if (block->pending_slot != -1) {
+        fprintf(stderr, "A frame is already being written to %s.", block->filename);
+        return BLOCK_NOT_ACTIVE;
+    }
+
+    uint64_t frame_uid;
+    if (buffer->multi_producer) {
+        frame_uid = atomic_fetch_add(&buffer->ticket, 1) + 1;
+        int exit_code = wait_for_free_slot(block, frame_uid);
+        if (exit_code != SUCCESS) return exit_code;
+    } else {
+        frame_uid = atomic_load(&buffer->frame_cnt) + 1;
+    }
+    int exit_code = make_room(block, frame_uid);
+    if (exit_code != SUCCESS) return exit_code;
+
+    uint32_t buffer_to_write_to = frame_uid % buffer->slot_count;
+    frame_metadata_t* metadata = &buffer->metadata[buffer_to_write_to];
+
+    if (block->adopted_slot == (int)buffer_to_write_to) {
+        // the writer we took over from crashed while it held this slot, which is still
+        // the one to write next since it never committed its frame. It may have died
+        // in write_lock while readers still held the slot, those have to leave first
+        block->adopted_slot = -1;
+        if (buffer->sync_mode == SYNC_RWLOCK) wait_for_slot_readers(metadata);
+    } else if (buffer->sync_mode == SYNC_SEQLOCK) {
+        // an odd sequence tells readers that the slot is being overwritten. The writer
+        // never waits on readers, they detect the change and retry instead.
+        uint64_t seq = atomic_load_explicit(&metadata->seq, memory_order_relaxed);
+        atomic_store_explicit(&metadata->seq, seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+    } else {
+        // grab write lock, it is held until the frame is committed. Waiting for readers
+        // that still hold the slot is only timed when it happens.
+        writer_stats_t* stats = writer_stats(block);
+        uint64_t start = stats_time(stats);
+        if (write_lock(metadata)) stats_add_time(stats, lock_wait_ns, start);
+    }
+    block->pending_slot = buffer_to_write_to;
+    block->pending_uid = frame_uid;
+
+    *destination = slot_image(buffer, buffer_to_write_to);
+    return SUCCESS;
+}
+
+// The registry of blocks (see [list_blocks]) is a single shared file that every process
+// maps the first time it needs it, and which is never removed. [REGISTRY_VERSION] has to
+// be bumped whenever the layout of registry_t changes.
+#define REGISTRY_VERSION 1u
+
+// A block in the registry. [seq] is odd while the process that made it odd claims,
+// fills in or releases the entry. Listers copy an entry and retry if [seq] changed in the
+// meantime, like SYNC_SEQLOCK readers do with slots. [fps_millis] is updated by the
+// writer on its own.
+typedef struct registry_entry {
+    _Alignas(CACHE_LINE) _Atomic uint32_t seq;
+    bool used;
+    char direction[MAX_DIRECTION_LENGTH + 1];
+    size_t width, height, depth;
+    int pixel_format;
+    size_t level_count;
+    size_t slot_count;
+    int sync_mode;
+    size_t payload_capacity;
+    pid_t owner;
+    uint32_t generation;
+    _Atomic uint32_t fps_millis;
+} registry_entry_t;
+
+// [changes] is bumped, and woken with FUTEX_WAKE, whenever an entry is added or removed
+typedef struct registry {
+    _Atomic uint32_t version;  // [REGISTRY_VERSION], 0 until the file is first set up
+    _Atomic uint32_t changes;
+    registry_entry_t entries[MAX_LISTED_BLOCKS];
+} registry_t;
+
+static _Atomic(registry_t*) registry_memory = NULL;
+
+// Maps the registry, creating it if it does not exist yet. Returns NULL if another
+// version of the library set it up.
+registry_t* map_registry() {
+    registry_t* registry = atomic_load_explicit(&registry_memory, memory_order_acquire);
+    if (registry != NULL) return registry;
+
+    // an empty file of the right size is an empty registry, so processes creating it at
+    // the same time cannot get in each other's way
+    int file = open(REGISTRY_ADDRESS, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP |
+                                                        S_IWGRP | S_IROTH | S_IWOTH);
+    if (file == -1 || ftruncate(file, sizeof(registry_t)) == -1) {
+        fprintf(stderr, "Failed to open the registry \"%s\": %s.", REGISTRY_ADDRESS,
+                strerror(errno));
+        if (file != -1) close(file);
+        return NULL;
+    }
+    registry = mmap(NULL, sizeof(registry_t), PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    close(file);
+    if (registry == MAP_FAILED) return NULL;
+
+    uint32_t version = 0;
+    if (!atomic_compare_exchange_strong(&registry->version, &version, REGISTRY_VERSION) &&
+        version != REGISTRY_VERSION) {
+        fprintf(stderr, "The registry \"%s\" has version %u, not %u.", REGISTRY_ADDRESS,
+                version, REGISTRY_VERSION);
+        munmap(registry, sizeof(registry_t));
+        return NULL;
+    }
+
+    // threads that map the registry at the same time keep the first mapping
+    registry_t* mapped = NULL;
+    if (!atomic_compare_exchange_strong(&registry_memory, &mapped, registry)) {
+        munmap(registry, sizeof(registry_t));
+        return mapped;
+    }
+    return registry;
+}
+
+// Returns true if [entry] holds [direction], or if it is free for a NULL [direction]
+bool registry_entry_matches(const registry_entry_t* entry, const char* direction) {
+    if (direction == NULL) return !entry->used;
+    return entry->used && strcmp(entry->direction, direction) == 0;
+}
+
+// Makes [entry] odd if it matches [direction], see [registry_entry_matches]. Returns the
+// even [seq] it had, or 1 if it does not match or someone else is changing it.
+uint32_t claim_registry_entry(registry_entry_t* entry, const char* direction) {
+    uint32_t seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+    if ((seq & 1) || !registry_entry_matches(entry, direction) ||
+        !atomic_compare_exchange_strong(&entry->seq, &seq, seq + 1))
+        return 1;
+    atomic_thread_fence(memory_order_release);
+    // the entry may have changed between the check and the claim
+    if (!registry_entry_matches(entry, direction)) {
+        atomic_store_explicit(&entry->seq, seq + 2, memory_order_release);
+        return 1;
+    }
+    return seq;
+}
+
+void publish_registry_entry(registry_t* registry, registry_entry_t* entry, uint32_t seq) {
+    atomic_store_explicit(&entry->seq, seq + 2, memory_order_release);
+    atomic_fetch_add(&registry->changes, 1);
+    syscall(SYS_futex, &registry->changes, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Removes [direction] from the registry
+void unregister_block(const char* direction) {
+    registry_t* registry = map_registry();
+    if (registry == NULL) return;
+    for (size_t i = 0; i < MAX_LISTED_BLOCKS; i++) {
+        registry_entry_t* entry = &registry->entries[i];
+        uint32_t seq = claim_registry_entry(entry, direction);
+        if (seq & 1) continue;
+        entry->used = false;
+        publish_registry_entry(registry, entry, seq);
+    }
+}
+
+// Adds the block [block] writes to to the registry, replacing any entry a previous
+// writer of the block left behind
+void register_block(block_t* block) {
+    const char* direction = block->filename + strlen(BLOCK_DIR);
+    if (strlen(direction) > MAX_DIRECTION_LENGTH) return;
+    registry_t* registry = map_registry();
+    if (registry == NULL) return;
+    unregister_block(direction);
+
+    buffer_t* buffer = block->buffer;
+    for (size_t i = 0; i < MAX_LISTED_BLOCKS; i++) {
+        registry_entry_t* entry = &registry->entries[i];
+        uint32_t seq = claim_registry_entry(entry, NULL);
+        if (seq & 1) continue;
+        entry->used = true;
+        strcpy(entry->direction, direction);
+        entry->width = buffer->width;
+        entry->height = buffer->height;
+        entry->depth = buffer->depth;
+        entry->pixel_format = buffer->format.pixel_format;
+        entry->level_count = buffer->level_count;
+        entry->slot_count = buffer->slot_count;
+        entry->sync_mode = buffer->sync_mode;
+        entry->payload_capacity = buffer->slot_size;
+        entry->owner = atomic_load(&buffer->owner);
+        entry->generation = atomic_load(&buffer->generation);
+        atomic_store_explicit(&entry->fps_millis, 0, memory_order_relaxed);
+        publish_registry_entry(registry, entry, seq);
+        block->registry_entry = i;
+        return;
+    }
+    fprintf(stderr, "The registry is full, %s is not listed.", block->filename);
+}
+
+// Updates the fps of [block] in the registry once a second has passed since the last
+// update. Called by the writer with every frame, so it only reads a coarse clock.
+void update_registry_rate(block_t* block) {
+    if (block->registry_entry == -1) return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+    if (now_ns - block->rate_start_ns < 1000000000ull) return;
+
+    uint64_t frames = atomic_load_explicit(&block->buffer->frame_cnt, memory_order_relaxed);
+    if (block->rate_start_ns != 0) {
+        registry_entry_t* entry = &map_registry()->entries[block->registry_entry];
+        uint64_t fps_millis = (frames - block->rate_start_frame) * 1000000000000ull /
+                              (now_ns - block->rate_start_ns);
+        atomic_store_explicit(&entry->fps_millis, fps_millis, memory_order_relaxed);
+    }
+    block->rate_start_ns = now_ns;
+    block->rate_start_frame = frames;
+}
+
+size_t list_blocks(block_info_t* blocks, size_t n) {
+    registry_t* registry = map_registry();
+    if (registry == NULL) return 0;
+    size_t count = 0;
+    for (size_t i = 0; i < MAX_LISTED_BLOCKS && count < n; i++) {
+        registry_entry_t* entry = &registry->entries[i];
+        registry_entry_t copy;
+        // an entry that stays odd belongs to a process that died while changing it
+        bool consistent = false;
+        for (int attempt = 0; attempt < 100 && !consistent; attempt++) {
+            uint32_t seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+            if (seq & 1) continue;
+            memcpy(&copy, entry, sizeof(copy));
+            atomic_thread_fence(memory_order_acquire);
+            consistent = atomic_load_explicit(&entry->seq, memory_order_relaxed) == seq;
+        }
+        if (!consistent || !copy.used) continue;
+
+        block_info_t* info = &blocks[count++];
+        strcpy(info->direction, copy.direction);
+        info->width = copy.width;
+        info->height = copy.height;
+        info->depth = copy.depth;
+        info->pixel_format = copy.pixel_format;
+        info->level_count = copy.level_count;
+        info->slot_count = copy.slot_count;
+        info->sync_mode = copy.sync_mode;
+        info->payload_capacity = copy.payload_capacity;
+        info->fps = atomic_load_explicit(&entry->fps_millis, memory_order_relaxed) / 1000.0;
+        info->owner = copy.owner;
+        info->generation = copy.generation;
+        info->alive = kill(copy.owner, 0) == 0 || errno == EPERM;
+    }
+    return count;
+}
+
+bool watch_blocks(uint32_t* version, int timeout_ms) {
+    registry_t* registry = map_registry();
+    if (registry == NULL) return false;
+    uint64_t deadline = monotonic_ns() + (uint64_t)timeout_ms * 1000000ull;
+    while (true) {
+        uint32_t changes = atomic_load(&registry->changes);
+        if (changes != *version) {
+            *version = changes;
+            return true;
+        }
+        struct timespec timeout;
+        if (timeout_ms >= 0) {
+            uint64_t now = monotonic_ns();
+            if (now >= deadline) return false;
+            timeout.tv_sec = (deadline - now) / 1000000000ull;
+            timeout.tv_nsec = (deadline - now) % 1000000000ull;
+        }
+        syscall(SYS_futex, &registry->changes, FUTEX_WAIT, changes,
+                timeout_ms >= 0 ? &timeout : NULL, NULL, 0);
+    }
+}
+
+image* begin_write_frame(block_t* block) {
+    image* destination;
+    return begin_write_slot(block, &destination) == SUCCESS ? destination : NULL;
 }
 
 int write_frame(block_t* block, size_t width, size_t height, size_t depth,
@@ -61,125 +1014,852 @@ int write_frame(block_t* block, size_t width, size_t height, size_t depth,
     // assert precondition: frame size is homogenous
     if (buffer->width != width ||
         buffer->height != height ||
-        buffer->depth != depth) {
+        buffer->depth != depth ||
+        buffer_image_size(buffer) > buffer->slot_size) {
         return FRAME_SIZE_MISMATCH;
     }
 
-    // assert precondition: block is active
-    if (!buffer->is_alive) return BLOCK_NOT_ACTIVE;
+    image* destination;
+    int exit_code = begin_write_slot(block, &destination);
+    if (exit_code != SUCCESS) return exit_code;
 
-    uint32_t buffer_to_write_to = (buffer->frame_cnt + 1) % BUFFER_COUNT;
-    frame_metadata_t* metadata = &buffer->metadata[buffer_to_write_to];
+    // write the image
+    writer_stats_t* stats = writer_stats(block);
+    uint64_t start = stats_time(stats);
+    memcpy(destination, data, buffer_image_size(buffer) * sizeof(unsigned char));
+    stats_add_time(stats, copy_ns, start);
+
+    return commit_write_frame(block, acquisition_time);
+}
+
+int write_packet(block_t* block, const void* data, size_t size, uint32_t codec,
+                 uint64_t acquisition_time) {
+    // assert precondition: the packet fits into a slot
+    if (size > block->buffer->slot_size) return FRAME_SIZE_MISMATCH;
+
+    image* destination;
+    int exit_code = begin_write_slot(block, &destination);
+    if (exit_code != SUCCESS) return exit_code;
+
+    writer_stats_t* stats = writer_stats(block);
+    uint64_t start = stats_time(stats);
+    memcpy(destination, data, size);
+    stats_add_time(stats, copy_ns, start);
+
+    return commit_write_packet(block, size, codec, acquisition_time);
+}
+
+int commit_write_frame(block_t* block, uint64_t acquisition_time) {
+    return commit_write_packet(block, buffer_image_size(block->buffer), CODEC_RAW,
+                               acquisition_time);
+}
+
+int commit_write_packet(block_t* block, size_t size, uint32_t codec,
+                        uint64_t acquisition_time) {
+    buffer_t* buffer = block->buffer;
+
+    // assert precondition: begin_write_frame was called
+    if (block->pending_slot == -1) return NO_FRAME_IN_PROGRESS;
+    // the frame stays in progress, so that it can still be committed with a valid size
+    if (size > buffer->slot_size) return FRAME_SIZE_MISMATCH;
+    if (buffer->level_count > 0 && (codec != CODEC_RAW || size != buffer_image_size(buffer)))
+        return FRAME_SIZE_MISMATCH;
+
+    // derive the other levels from the image while the slot is still held
+    image* slot = slot_image(buffer, block->pending_slot);
+    writer_stats_t* stats = writer_stats(block);
+    uint64_t start = stats_time(stats);
+    for (size_t i = 1; i <= buffer->level_count; i++) {
+        image_level_t* level = &buffer->levels[i];
+        convert_image(slot, &buffer->format, slot + level->offset, level->conversion,
+                      level->scale);
+    }
+    if (buffer->level_count > 0) stats_add_time(stats, copy_ns, start);
 
-    // grab write lock
-    pthread_rwlock_wrlock(&metadata->rwlock);
+    frame_metadata_t* metadata = &buffer->metadata[block->pending_slot];
+    block->pending_slot = -1;
 
-    // write the image and corresponding metadata
-    size_t image_size = buffer_image_size(buffer);
-    memcpy(&buffer->images[image_size * buffer_to_write_to],
-           data, image_size * sizeof(unsigned char));
-    buffer->frame_cnt += 1;
-    metadata->acquisition_time = acquisition_time;
-    metadata->frame_uid = buffer->frame_cnt;
+    // write the corresponding metadata
+    uint64_t frame_uid = block->pending_uid;
+    atomic_store_explicit(&metadata->acquisition_time, acquisition_time, memory_order_relaxed);
+    atomic_store_explicit(&metadata->payload_size, size, memory_order_relaxed);
+    atomic_store_explicit(&metadata->codec, codec, memory_order_relaxed);
+    atomic_store_explicit(&metadata->frame_uid, frame_uid, memory_order_relaxed);
 
     // release write lock
-    pthread_rwlock_unlock(&metadata->rwlock);
+    if (buffer->sync_mode == SYNC_SEQLOCK) {
+        uint64_t seq = atomic_load_explicit(&metadata->seq, memory_order_relaxed);
+        atomic_store_explicit(&metadata->seq, seq + 1, memory_order_release);
+    } else {
+        write_unlock(metadata);
+    }
+    // the frame only becomes visible to readers once it is completely written
+    if (buffer->multi_producer) {
+        atomic_store(&metadata->committed_uid, frame_uid);
+        if (!publish_frames(buffer)) return SUCCESS;
+    } else {
+        atomic_store_explicit(&buffer->frame_cnt, frame_uid, memory_order_release);
+    }
 
     // notify all watchers that a new image has been posted
-    // we take care to avoid the following scenario: read thread sees that
-    //      no frame is available -> broadcast -> read thread sleeps -> misses out on frame
-    pthread_mutex_lock(&buffer->cond_mutex);
-    pthread_cond_broadcast(&buffer->cond);
-    pthread_mutex_unlock(&buffer->cond_mutex);
+    signal_watchers(buffer);
+    notify_readers(block);
+    update_registry_rate(block);
 
     return SUCCESS;
 }
 
-int read_frame(block_t* block, frame_t* frame, bool block_thread) {
-    // this needs to be inside because of the case:
-    // read sees buffer is alive -> buffer is not alive -> broadcast give up->
-    // read thread sleeps -> forever asleep.
-
-    pthread_mutex_lock(&block->buffer->cond_mutex);
-    // figure out which frame needs to be grabbed
+// Waits for (if [block_thread]) a frame in [block] that is newer than [last_uid].
+int wait_for_new_frame(block_t* block, uint64_t last_uid, bool block_thread) {
     buffer_t* buffer = block->buffer;
+    bool drained = false;
+    while (true) {
+        // the signal has to be sampled before the checks, so that a frame that is
+        // committed right after them makes the wait return immediately
+        uint32_t signal = atomic_load(&buffer->frame_signal);
+        if (!buffer->is_alive) return BLOCK_NOT_ACTIVE;
+        if (atomic_load_explicit(&buffer->frame_cnt, memory_order_acquire) > last_uid)
+            return SUCCESS;
+        if (!block_thread) {
+            // the notification fd stays readable until it is drained. That is only done
+            // when there is no frame left to read, and followed by another check so that
+            // a notification that arrives in between cannot be lost.
+            if (block->notify_fd == -1 || drained) return NO_NEW_FRAME;
+            drain_notifications(block);
+            drained = true;
+            continue;
+        }
+        reader_slot_t* stats = reader_stats(block);
+        uint64_t start = stats_time(stats);
+        if (!spin_for_signal(block, signal)) wait_for_signal(buffer, signal);
+        stats_add_time(stats, frame_wait_ns, start);
+    }
+}
 
-    // realloc frame data outside of locking any threads so code does not
-    // block for longer than it needs to
-    frame->data = (unsigned char*)realloc(frame->data,
-                                          buffer_image_size(buffer));
-    frame->width = buffer->width;
-    frame->height = buffer->height;
-    frame->depth = buffer->depth;
-
-    // assert preconditions
-    if (!buffer->is_alive) {
-        pthread_mutex_unlock(&buffer->cond_mutex);
-        return BLOCK_NOT_ACTIVE;
+// Read-locks [slot] of [block]. If the writer is busy with the slot, this waits until it
+// commits. Fails with BLOCK_NOT_ACTIVE if the block dies in the meantime.
+int read_lock_slot(block_t* block, int slot) {
+    buffer_t* buffer = block->buffer;
+    frame_metadata_t* metadata = &buffer->metadata[slot];
+    reader_slot_t* stats = NULL;
+    uint64_t start = 0;
+    while (true) {
+        uint32_t signal = atomic_load(&buffer->frame_signal);
+        if (try_read_lock(metadata)) {
+            if (start != 0) stats_add_time(stats, lock_wait_ns, start);
+            return SUCCESS;
+        }
+        // lock waits are only timed when they happen
+        if (start == 0) {
+            stats = reader_stats(block);
+            start = stats_time(stats);
+        }
+        if (!spin_for_signal(block, signal)) wait_for_signal(buffer, signal);
+        // if the framework is dead, then cleanly exit
+        if (!buffer->is_alive) return BLOCK_NOT_ACTIVE;
     }
+}
+
+// Waits for (if [block_thread]) and read-locks the slot that holds the earliest frame
+// in [block] newer than [last_uid]. On SUCCESS, [slot] is set to the index of the
+// locked slot and the caller is responsible for unlocking it.
+int lock_next_slot(block_t* block, uint64_t last_uid, bool block_thread, int* slot) {
+    buffer_t* buffer = block->buffer;
+    int exit_code = wait_for_new_frame(block, last_uid, block_thread);
+    if (exit_code != SUCCESS) return exit_code;
 
-    uint64_t newest_buffer = buffer->frame_cnt;
-    uint64_t last_buffer = frame->frame_uid;
+    // figure out which frame needs to be grabbed
+    uint64_t newest_buffer = atomic_load(&buffer->frame_cnt);
 
     uint64_t target_frame_uid;
-    if (newest_buffer < BUFFER_COUNT)
-        target_frame_uid = last_buffer + 1;
+    if (newest_buffer < buffer->slot_count)
+        target_frame_uid = last_uid + 1;
     else
         target_frame_uid = max(
-            last_buffer + 1,
-            newest_buffer - BUFFER_COUNT + 1);
+            last_uid + 1,
+            newest_buffer - buffer->slot_count + 1);
 
     // this is within the range of an integer.
-    int target_buffer = target_frame_uid % BUFFER_COUNT;
-
-    // try to accquire read lock, if it isn't available,
-    // register self as watcher
-    frame_metadata_t* metadata = &(buffer->metadata[target_buffer]);
-
-    if (last_buffer == newest_buffer) {
-        if (block_thread) {
-            // if the newest frame is not yet available
-            pthread_cond_wait(&buffer->cond, &buffer->cond_mutex);
-            if (!buffer->is_alive) {
-                pthread_mutex_unlock(&buffer->cond_mutex);
-                return BLOCK_NOT_ACTIVE;
-            }
-        } else {
-            pthread_mutex_unlock(&buffer->cond_mutex);
-            return NO_NEW_FRAME;
+    int target_buffer = target_frame_uid % buffer->slot_count;
+    exit_code = read_lock_slot(block, target_buffer);
+    if (exit_code != SUCCESS) return exit_code;
+
+    *slot = target_buffer;
+    return SUCCESS;
+}
+
+// Waits for (if [block_thread]) a frame in [block] that is newer than [last_uid]. On
+// SUCCESS, [first_uid] and [count] describe the up to [n] consecutive frames that end
+// with the newest frame and are still held by the buffer.
+int newest_frame_range(block_t* block, uint64_t last_uid, size_t n, bool block_thread,
+                       uint64_t* first_uid, size_t* count) {
+    buffer_t* buffer = block->buffer;
+    int exit_code = wait_for_new_frame(block, last_uid, block_thread);
+    if (exit_code != SUCCESS) return exit_code;
+
+    uint64_t newest_buffer = atomic_load_explicit(&buffer->frame_cnt, memory_order_acquire);
+    // the oldest slot is the next one to be overwritten, so SYNC_SEQLOCK readers leave it
+    // out of the range when the buffer is full
+    size_t available = buffer->slot_count;
+    if (buffer->sync_mode == SYNC_SEQLOCK && available > 1) available -= 1;
+    *count = min(min(n, available), newest_buffer);
+    *first_uid = newest_buffer - *count + 1;
+    return SUCCESS;
+}
+
+// SYNC_SEQLOCK counterpart of [lock_next_slot]. Finds the slot that holds the earliest
+// frame in [block] newer than [last_uid] without taking any locks. On SUCCESS, [slot] and
+// [seq] are set to the slot and its (even) sequence number. The slot is only guaranteed to
+// be consistent if its sequence number is still [seq] after it has been read.
+int find_next_slot(block_t* block, uint64_t last_uid, bool block_thread,
+                   int* slot, uint64_t* seq) {
+    buffer_t* buffer = block->buffer;
+    while (true) {
+        int exit_code = wait_for_new_frame(block, last_uid, block_thread);
+        if (exit_code != SUCCESS) return exit_code;
+
+        uint64_t newest_buffer = atomic_load_explicit(&buffer->frame_cnt, memory_order_acquire);
+        uint64_t target_frame_uid;
+        if (newest_buffer < buffer->slot_count)
+            target_frame_uid = last_uid + 1;
+        else
+            target_frame_uid = max(
+                last_uid + 1,
+                newest_buffer - buffer->slot_count + 1);
+
+        int target_buffer = target_frame_uid % buffer->slot_count;
+        uint64_t target_seq = atomic_load_explicit(&buffer->metadata[target_buffer].seq,
+                                                   memory_order_acquire);
+        if (target_seq & 1) {
+            // the writer is overwriting the target frame, so skip over it
+            last_uid = target_frame_uid;
+            continue;
+        }
+
+        *slot = target_buffer;
+        *seq = target_seq;
+        return SUCCESS;
+    }
+}
+
+// Returns true if the slot read after [find_next_slot] returned [seq] was not
+// modified in the meantime.
+bool slot_is_unchanged(buffer_t* buffer, int slot, uint64_t seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&buffer->metadata[slot].seq, memory_order_relaxed) == seq;
+}
+
+// Makes sure that [frame] can hold [image_size] bytes. Returns false if it cannot,
+// which is only the case for caller-supplied storage that is too small.
+bool reserve_frame(frame_t* frame, size_t image_size) {
+    if (frame->capacity >= image_size) return true;
+
+    switch (frame->storage) {
+        case FRAME_STORAGE_CALLER:
+            return false;
+        case FRAME_STORAGE_PAGE_ALIGNED: {
+            void* data;
+            if (posix_memalign(&data, sysconf(_SC_PAGESIZE), image_size) != 0) return false;
+            free(frame->data);
+            frame->data = (image*)data;
+            break;
+        }
+        default:
+            frame->data = (image*)realloc(frame->data, image_size);
+            break;
+    }
+    frame->capacity = image_size;
+    return true;
+}
+
+// how a read copies the image out of a slot into a frame
+//  - COPY_PAYLOAD: the payload as it is
+//  - COPY_CONVERTED: converted with [conversion] and [scale], see [read_frame_converted]
+//  - COPY_REGION: only the pixels of [region], see [read_frame_roi]
+#define COPY_PAYLOAD 0
+#define COPY_CONVERTED 1
+#define COPY_REGION 2
+
+// [width], [height], [depth] and [format] describe the image the frame receives
+typedef struct image_copy {
+    int mode;
+    size_t width, height, depth;
+    image_format_t format;
+    int conversion;
+    size_t scale;
+    size_t offset;          // first byte of [region] in the image
+    image_format_t region;  // the pixels of a COPY_REGION, laid out as they are in the image
+} image_copy_t;
+
+// Describes the [width] * [height] pixels at [x], [y] of single plane images laid out as
+// [format] in [region], with rows as far apart as they are in the image. [offset] is set
+// to the first byte of the region. Returns false if the region is empty or
+// does not lie inside of the image.
+bool image_region(const image_format_t* format, size_t x, size_t y, size_t width,
+                  size_t height, image_format_t* region, size_t* offset) {
+    const plane_t* plane = &format->planes[0];
+    if (format->plane_count != 1 || width == 0 || height == 0 || x > plane->width ||
+        width > plane->width - x || y > plane->height || height > plane->height - y)
+        return false;
+
+    size_t pixel_size = plane->channels * format->element_size;
+    *offset = plane->offset + y * plane->stride + x * pixel_size;
+    *region = *format;
+    region->planes[0].offset = 0;
+    region->planes[0].width = width;
+    region->planes[0].height = height;
+    region->size = (height - 1) * plane->stride + width * pixel_size;
+    return true;
+}
+
+// Prepares [copy] to read the region at [x], [y] of the images [block] reads. Returns
+// false if there is no such region.
+bool init_region_copy(block_t* block, size_t x, size_t y, size_t width, size_t height,
+                      image_copy_t* copy) {
+    const image_level_t* level = block_level(block);
+    // payload blocks are the only ones whose slots are not sized for one image
+    if (block_payload_capacity(block) != level->format.size ||
+        !image_region(&level->format, x, y, width, height, &copy->region, &copy->offset))
+        return false;
+
+    copy->mode = COPY_REGION;
+    copy->width = width;
+    copy->height = height;
+    copy->depth = level->depth;
+    image_format_init(&copy->format, level->format.pixel_format, width, height, level->depth,
+                      0);
+    return true;
+}
+
+// Copies the image of [slot] into [frame] as described by [copy].
+void copy_slot_image(block_t* block, int slot, size_t payload_size, frame_t* frame,
+                     const image_copy_t* copy) {
+    const image* source = block_slot_image(block, slot);
+    switch (copy->mode) {
+        case COPY_CONVERTED:
+            convert_image(source, &block_level(block)->format, frame->data, copy->conversion,
+                          copy->scale);
+            break;
+        case COPY_REGION: {
+            const plane_t* region = &copy->region.planes[0];
+            const plane_t* destination = &copy->format.planes[0];
+            source += copy->offset;
+            for (size_t row = 0; row < region->height; row++)
+                memcpy(frame->data + row * destination->stride, source + row * region->stride,
+                       destination->stride);
+            break;
         }
+        default:
+            memcpy(frame->data, source, payload_size);
+            break;
     }
-    // try to acquire read lock, if that fails, then we are busy
-    while (pthread_rwlock_tryrdlock(&metadata->rwlock) != 0) {
-        pthread_cond_wait(&buffer->cond, &buffer->cond_mutex);
-        if (!buffer->is_alive) {
-            pthread_mutex_unlock(&buffer->cond_mutex);
-            return BLOCK_NOT_ACTIVE;
+}
+
+// Implements [read_frame] and its variants.
+int read_frame_as(block_t* block, frame_t* frame, const image_copy_t* copy,
+                  bool block_thread) {
+    buffer_t* buffer = block->buffer;
+    // the size of a payload is only known once it is read
+    size_t frame_size =
+        copy->mode == COPY_PAYLOAD ? block_payload_capacity(block) : copy->format.size;
+
+    // grow frame data outside of locking any threads so code does not
+    // block for longer than it needs to. Frames that are already large enough
+    // never touch the allocator.
+    if (!reserve_frame(frame, frame_size)) return FRAME_SIZE_MISMATCH;
+    frame->width = copy->width;
+    frame->height = copy->height;
+    frame->depth = copy->depth;
+    frame->format = copy->format;
+    reader_slot_t* stats = reader_stats(block);
+    uint64_t previous_uid = frame->frame_uid;
+
+    if (buffer->sync_mode == SYNC_SEQLOCK) {
+        uint64_t last_uid = frame->frame_uid;
+        while (true) {
+            int slot;
+            uint64_t seq;
+            int exit_code = find_next_slot(block, last_uid, block_thread, &slot, &seq);
+            if (exit_code != SUCCESS) return exit_code;
+
+            frame_metadata_t* metadata = &buffer->metadata[slot];
+            uint64_t frame_uid = atomic_load_explicit(&metadata->frame_uid, memory_order_relaxed);
+            uint64_t acquisition_time = atomic_load_explicit(&metadata->acquisition_time,
+                                                             memory_order_relaxed);
+            size_t payload_size = block_slot_payload_size(block, metadata);
+            uint32_t codec = atomic_load_explicit(&metadata->codec, memory_order_relaxed);
+            uint64_t start = stats_time(stats);
+            copy_slot_image(block, slot, payload_size, frame, copy);
+            stats_add_time(stats, copy_ns, start);
+
+            if (slot_is_unchanged(buffer, slot, seq)) {
+                frame->frame_uid = frame_uid;
+                frame->acquisition_time = acquisition_time;
+                frame->payload_size = copy->mode == COPY_PAYLOAD ? payload_size : frame_size;
+                frame->codec = codec;
+                count_frames_read(stats, previous_uid, frame_uid, 1);
+                advance_cursor(block, frame_uid);
+                return SUCCESS;
+            }
+            // the frame was overwritten while it was copied, so there is a newer one
+            last_uid = max(last_uid, frame_uid);
         }
-    }  // we have acquired permissions at this point.
-    // if the framework is dead, then cleanly exit
+    }
 
-    pthread_mutex_unlock(&buffer->cond_mutex);
+    int slot;
+    int exit_code = lock_next_slot(block, frame->frame_uid, block_thread, &slot);
+    if (exit_code != SUCCESS) return exit_code;
 
     // read from the frame
-    size_t image_size = frame_image_size(frame);
+    frame_metadata_t* metadata = &buffer->metadata[slot];
     frame->frame_uid = metadata->frame_uid;
     frame->acquisition_time = metadata->acquisition_time;
-    memcpy(frame->data, &buffer->images[image_size * target_buffer], image_size * sizeof(unsigned char));
+    size_t payload_size = block_slot_payload_size(block, metadata);
+    frame->payload_size = copy->mode == COPY_PAYLOAD ? payload_size : frame_size;
+    frame->codec = metadata->codec;
+    uint64_t start = stats_time(stats);
+    copy_slot_image(block, slot, payload_size, frame, copy);
+    stats_add_time(stats, copy_ns, start);
+
+    read_unlock(metadata);
+    count_frames_read(stats, previous_uid, frame->frame_uid, 1);
+    advance_cursor(block, frame->frame_uid);
+    return SUCCESS;
+}
+
+int read_frame(block_t* block, frame_t* frame, bool block_thread) {
+    const image_level_t* level = block_level(block);
+    image_copy_t copy = {
+        .mode = COPY_PAYLOAD,
+        .width = level->width,
+        .height = level->height,
+        .depth = level->depth,
+        .format = level->format,
+    };
+    return read_frame_as(block, frame, &copy, block_thread);
+}
+
+int read_frame_converted(block_t* block, frame_t* frame, int conversion, size_t scale,
+                         bool block_thread) {
+    const image_level_t* level = block_level(block);
+    image_copy_t copy = {.mode = COPY_CONVERTED, .conversion = conversion, .scale = scale};
+    // payload blocks are the only ones whose slots are not sized for one image
+    if (block_payload_capacity(block) != level->format.size ||
+        !converted_image_format(&level->format, conversion, scale, &copy.format))
+        return CONVERSION_NOT_SUPPORTED;
+    copy.width = copy.format.planes[0].width;
+    copy.height = copy.format.planes[0].height;
+    copy.depth = copy.format.planes[0].channels;
+    return read_frame_as(block, frame, &copy, block_thread);
+}
+
+int read_frame_roi(block_t* block, frame_t* frame, size_t x, size_t y, size_t width,
+                   size_t height, bool block_thread) {
+    image_copy_t copy;
+    if (!init_region_copy(block, x, y, width, height, &copy)) return INVALID_REGION;
+    return read_frame_as(block, frame, &copy, block_thread);
+}
+
+int acquire_frame_view(block_t* block, frame_view_t* view, bool block_thread) {
+    // a view that is still held would keep its slot locked forever
+    if (view->data != NULL) release_frame_view(block, view);
 
-    pthread_rwlock_unlock(&metadata->rwlock);
+    int slot;
+    uint64_t seq = 0;
+    uint64_t previous_uid = view->frame_uid;
+    int exit_code;
+    if (block->buffer->sync_mode == SYNC_SEQLOCK)
+        exit_code = find_next_slot(block, view->frame_uid, block_thread, &slot, &seq);
+    else
+        exit_code = lock_next_slot(block, view->frame_uid, block_thread, &slot);
+    if (exit_code != SUCCESS) return exit_code;
+
+    buffer_t* buffer = block->buffer;
+    frame_metadata_t* metadata = &buffer->metadata[slot];
+    const image_level_t* level = block_level(block);
+    view->width = level->width;
+    view->height = level->height;
+    view->depth = level->depth;
+    view->format = level->format;
+    view->frame_uid = metadata->frame_uid;
+    view->acquisition_time = metadata->acquisition_time;
+    view->payload_size = block_slot_payload_size(block, metadata);
+    view->codec = metadata->codec;
+    view->data = block_slot_image(block, slot);
+    view->slot = slot;
+    view->seq = seq;
+    count_frames_read(reader_stats(block), previous_uid, view->frame_uid, 1);
+    return SUCCESS;
+}
+
+int acquire_frame_view_roi(block_t* block, frame_view_t* view, size_t x, size_t y,
+                           size_t width, size_t height, bool block_thread) {
+    image_copy_t copy;
+    if (!init_region_copy(block, x, y, width, height, &copy)) {
+        // like [acquire_frame_view], a view that is still held is released first
+        release_frame_view(block, view);
+        return INVALID_REGION;
+    }
+    int exit_code = acquire_frame_view(block, view, block_thread);
+    if (exit_code != SUCCESS) return exit_code;
+
+    view->width = width;
+    view->height = height;
+    view->format = copy.region;
+    view->payload_size = copy.region.size;
+    view->data += copy.offset;
     return SUCCESS;
 }
 
+int release_frame_view(block_t* block, frame_view_t* view) {
+    if (view->data == NULL) return SUCCESS;
+    view->data = NULL;
+
+    buffer_t* buffer = block->buffer;
+    int exit_code = SUCCESS;
+    if (buffer->sync_mode == SYNC_SEQLOCK) {
+        if (!slot_is_unchanged(buffer, view->slot, view->seq)) exit_code = FRAME_OVERWRITTEN;
+    } else {
+        read_unlock(&buffer->metadata[view->slot]);
+    }
+    advance_cursor(block, view->frame_uid);
+    return exit_code;
+}
+
+int read_frames(block_t* block, frame_t* frames, size_t n, size_t* frames_read,
+                bool block_thread) {
+    buffer_t* buffer = block->buffer;
+    reader_slot_t* stats = reader_stats(block);
+    *frames_read = 0;
+    if (n == 0) return SUCCESS;
+
+    // the window slides forward once there is a frame newer than all of [frames]
+    uint64_t last_uid = 0;
+    const image_level_t* level = block_level(block);
+    for (size_t i = 0; i < n; i++) {
+        if (!reserve_frame(&frames[i], block_payload_capacity(block)))
+            return FRAME_SIZE_MISMATCH;
+        frames[i].width = level->width;
+        frames[i].height = level->height;
+        frames[i].depth = level->depth;
+        frames[i].format = level->format;
+        last_uid = max(last_uid, frames[i].frame_uid);
+    }
+
+    while (true) {
+        uint64_t first_uid;
+        size_t count;
+        int exit_code = newest_frame_range(block, last_uid, n, block_thread,
+                                           &first_uid, &count);
+        if (exit_code != SUCCESS) return exit_code;
+
+        // every frame of the range is locked (or sequence checked) at the same time
+        // so that the writer cannot advance in between them
+        bool consistent = true;
+        uint64_t seqs[count];
+        size_t locked = 0;
+        for (; locked < count && consistent; locked++) {
+            int slot = (first_uid + locked) % buffer->slot_count;
+            frame_metadata_t* metadata = &buffer->metadata[slot];
+            if (buffer->sync_mode == SYNC_SEQLOCK) {
+                seqs[locked] = atomic_load_explicit(&metadata->seq, memory_order_acquire);
+                consistent = !(seqs[locked] & 1);
+            } else {
+                exit_code = read_lock_slot(block, slot);
+                if (exit_code != SUCCESS) break;
+            }
+            frame_t* frame = &frames[locked];
+            frame->frame_uid = atomic_load_explicit(&metadata->frame_uid, memory_order_relaxed);
+            frame->acquisition_time = atomic_load_explicit(&metadata->acquisition_time,
+                                                           memory_order_relaxed);
+            frame->payload_size = block_slot_payload_size(block, metadata);
+            frame->codec = atomic_load_explicit(&metadata->codec, memory_order_relaxed);
+            consistent = consistent && frame->frame_uid == first_uid + locked;
+            uint64_t start = stats_time(stats);
+            memcpy(frame->data, block_slot_image(block, slot), frame->payload_size);
+            stats_add_time(stats, copy_ns, start);
+        }
+
+        for (size_t i = 0; i < locked; i++) {
+            int slot = (first_uid + i) % buffer->slot_count;
+            if (buffer->sync_mode == SYNC_SEQLOCK)
+                consistent = consistent && slot_is_unchanged(buffer, slot, seqs[i]);
+            else
+                read_unlock(&buffer->metadata[slot]);
+        }
+        if (exit_code != SUCCESS) return exit_code;
+
+        if (consistent) {
+            *frames_read = count;
+            // frames of the window that were read before are not counted again
+            uint64_t first_new = max(first_uid, last_uid + 1);
+            count_frames_read(stats, last_uid, first_uid, first_uid + count - first_new);
+            advance_cursor(block, first_uid + count - 1);
+            return SUCCESS;
+        }
+        // the writer lapped the range while it was read, so try again with the newer
+        // frames. The overwritten frames must not move the window backwards.
+        for (size_t i = 0; i < locked; i++) frames[i].frame_uid = last_uid;
+    }
+}
+
+int acquire_frame_views(block_t* block, frame_view_t* views, size_t n, size_t* views_acquired,
+                        bool block_thread) {
+    buffer_t* buffer = block->buffer;
+    *views_acquired = 0;
+
+    uint64_t last_uid = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (views[i].data != NULL) release_frame_view(block, &views[i]);
+        last_uid = max(last_uid, views[i].frame_uid);
+    }
+
+    while (true) {
+        uint64_t first_uid;
+        size_t count;
+        int exit_code = newest_frame_range(block, last_uid, n, block_thread,
+                                           &first_uid, &count);
+        if (exit_code != SUCCESS) return exit_code;
+
+        bool consistent = true;
+        size_t acquired = 0;
+        for (; acquired < count && consistent; acquired++) {
+            int slot = (first_uid + acquired) % buffer->slot_count;
+            frame_metadata_t* metadata = &buffer->metadata[slot];
+            frame_view_t* view = &views[acquired];
+            view->seq = 0;
+            if (buffer->sync_mode == SYNC_SEQLOCK) {
+                view->seq = atomic_load_explicit(&metadata->seq, memory_order_acquire);
+                consistent = !(view->seq & 1);
+            } else {
+                exit_code = read_lock_slot(block, slot);
+                if (exit_code != SUCCESS) break;
+            }
+            const image_level_t* level = block_level(block);
+            view->width = level->width;
+            view->height = level->height;
+            view->depth = level->depth;
+            view->format = level->format;
+            view->frame_uid = atomic_load_explicit(&metadata->frame_uid, memory_order_relaxed);
+            view->acquisition_time = atomic_load_explicit(&metadata->acquisition_time,
+                                                          memory_order_relaxed);
+            view->payload_size = block_slot_payload_size(block, metadata);
+            view->codec = atomic_load_explicit(&metadata->codec, memory_order_relaxed);
+            view->data = block_slot_image(block, slot);
+            view->slot = slot;
+            consistent = consistent && view->frame_uid == first_uid + acquired;
+        }
+
+        if (exit_code == SUCCESS && consistent) {
+            *views_acquired = count;
+            uint64_t first_new = max(first_uid, last_uid + 1);
+            count_frames_read(reader_stats(block), last_uid, first_uid,
+                              first_uid + count - first_new);
+            return SUCCESS;
+        }
+        for (size_t i = 0; i < acquired; i++) {
+            release_frame_view(block, &views[i]);
+            views[i].frame_uid = last_uid;
+        }
+        if (exit_code != SUCCESS) return exit_code;
+    }
+}
+
+// Gives up the slot held by [view] without reading from it, so unlike
+// [release_frame_view] the reader's cursor stays where it is.
+void drop_frame_view(block_t* block, frame_view_t* view) {
+    if (view->data == NULL) return;
+    view->data = NULL;
+    if (block->buffer->sync_mode != SYNC_SEQLOCK)
+        read_unlock(&block->buffer->metadata[view->slot]);
+}
+
+// Leases the slot of frame [frame_uid] of [block] into [view] without waiting, like
+// [acquire_frame_view] does for the next frame. Returns FRAME_OVERWRITTEN if the slot no
+// longer holds that frame, or is being written.
+int acquire_frame_at(block_t* block, frame_view_t* view, uint64_t frame_uid) {
+    buffer_t* buffer = block->buffer;
+    int slot = frame_uid % buffer->slot_count;
+    frame_metadata_t* metadata = &buffer->metadata[slot];
+    uint64_t seq = 0;
+    if (buffer->sync_mode == SYNC_SEQLOCK) {
+        seq = atomic_load_explicit(&metadata->seq, memory_order_acquire);
+        if (seq & 1) return FRAME_OVERWRITTEN;
+    } else if (!try_read_lock(metadata)) {
+        return FRAME_OVERWRITTEN;
+    }
+
+    const image_level_t* level = block_level(block);
+    view->width = level->width;
+    view->height = level->height;
+    view->depth = level->depth;
+    view->format = level->format;
+    view->frame_uid = atomic_load_explicit(&metadata->frame_uid, memory_order_relaxed);
+    view->acquisition_time = atomic_load_explicit(&metadata->acquisition_time,
+                                                  memory_order_relaxed);
+    view->payload_size = block_slot_payload_size(block, metadata);
+    view->codec = atomic_load_explicit(&metadata->codec, memory_order_relaxed);
+    view->data = block_slot_image(block, slot);
+    view->slot = slot;
+    view->seq = seq;
+    if (view->frame_uid == frame_uid &&
+        (buffer->sync_mode != SYNC_SEQLOCK || slot_is_unchanged(buffer, slot, seq)))
+        return SUCCESS;
+    // the metadata of a SYNC_SEQLOCK view is only known to be consistent with its
+    // [frame_uid] if the slot did not change while it was read
+    drop_frame_view(block, view);
+    return FRAME_OVERWRITTEN;
+}
+
+// Sets [first_uid] and [last_uid] to the frames of [block] that are newer than
+// [previous_uid] and still held by the buffer, see [newest_frame_range]. Returns false if
+// there are none.
+bool synced_frame_range(block_t* block, uint64_t previous_uid, uint64_t* first_uid,
+                        uint64_t* last_uid) {
+    buffer_t* buffer = block->buffer;
+    uint64_t newest = atomic_load_explicit(&buffer->frame_cnt, memory_order_acquire);
+    // the oldest slot is left out in either sync mode, since a SYNC_RWLOCK writer holds it
+    // for as long as it takes to write a frame, see [begin_write_frame]
+    size_t available = buffer->slot_count;
+    if (available > 1) available -= 1;
+    *first_uid = max(previous_uid + 1, newest >= available ? newest - available + 1 : 1);
+    *last_uid = newest;
+    return *first_uid <= newest;
+}
+
+// Returns the time of frame [frame_uid] of [block] in nanoseconds, read without any lock.
+// The frames picked by [read_synced] are checked again once they are held.
+uint64_t peek_frame_time_ns(block_t* block, uint64_t frame_uid) {
+    frame_metadata_t* metadata = &block->buffer->metadata[frame_uid % block->buffer->slot_count];
+    return frame_time_ns(block, atomic_load_explicit(&metadata->acquisition_time,
+                                                     memory_order_relaxed));
+}
+
+int read_synced(block_t** blocks, size_t n, uint64_t tolerance_ns, frame_view_t* views,
+                bool block_thread) {
+    if (n == 0) return SUCCESS;
+    uint64_t previous_uids[n];
+    for (size_t i = 0; i < n; i++) {
+        if (views[i].data != NULL) release_frame_view(blocks[i], &views[i]);
+        previous_uids[i] = views[i].frame_uid;
+    }
+
+    while (true) {
+        // every block needs a frame it has not returned yet. The one that is missing one
+        // is waited on.
+        uint64_t first_uids[n], last_uids[n];
+        size_t waiting = n;
+        for (size_t i = 0; i < n && waiting == n; i++) {
+            if (!blocks[i]->buffer->is_alive) return BLOCK_NOT_ACTIVE;
+            if (!synced_frame_range(blocks[i], previous_uids[i], &first_uids[i], &last_uids[i]))
+                waiting = i;
+        }
+
+        // every candidate frame is tried as the oldest frame of a set, whose frames of the
+        // other blocks are the newest ones at most [tolerance_ns] younger than it. The set
+        // with the youngest oldest frame wins.
+        bool found = false;
+        uint64_t set_start = 0;
+        uint64_t set_uids[n];
+        for (size_t i = 0; i < n && waiting == n; i++) {
+            for (uint64_t uid = last_uids[i]; uid >= first_uids[i]; uid--) {
+                uint64_t start = peek_frame_time_ns(blocks[i], uid);
+                if (found && start <= set_start) break;
+                uint64_t uids[n];
+                bool complete = true;
+                for (size_t j = 0; j < n && complete; j++) {
+                    complete = false;
+                    for (uint64_t other = last_uids[j]; other >= first_uids[j]; other--) {
+                        uint64_t time = peek_frame_time_ns(blocks[j], other);
+                        if (time >= start && time - start <= tolerance_ns) {
+                            uids[j] = other;
+                            complete = true;
+                            break;
+                        }
+                    }
+                }
+                if (complete) {
+                    found = true;
+                    set_start = start;
+                    memcpy(set_uids, uids, sizeof(uids));
+                }
+            }
+        }
+
+        if (found) {
+            size_t acquired = 0;
+            while (acquired < n && acquire_frame_at(blocks[acquired], &views[acquired],
+                                                    set_uids[acquired]) == SUCCESS)
+                acquired++;
+            // the writers moved on while the set was picked, unless its frames are still
+            // the same now that they are held
+            uint64_t oldest = UINT64_MAX, newest = 0;
+            for (size_t i = 0; i < acquired; i++) {
+                uint64_t time = frame_time_ns(blocks[i], views[i].acquisition_time);
+                oldest = min(oldest, time);
+                newest = max(newest, time);
+            }
+            if (acquired == n && newest - oldest <= tolerance_ns) {
+                for (size_t i = 0; i < n; i++)
+                    count_frames_read(reader_stats(blocks[i]), previous_uids[i],
+                                      views[i].frame_uid, 1);
+                return SUCCESS;
+            }
+            for (size_t i = 0; i < n; i++) {
+                drop_frame_view(blocks[i], &views[i]);
+                views[i].frame_uid = previous_uids[i];
+            }
+            if (acquired == n) continue;
+            // its frame is overwritten (or being written, with a single slot) until the
+            // writer commits the next one
+            int exit_code = wait_for_new_frame(blocks[acquired], last_uids[acquired],
+                                               block_thread);
+            if (exit_code != SUCCESS) return exit_code;
+            continue;
+        }
+
+        // without a set, the block whose newest frame is the oldest has to catch up
+        if (waiting == n) {
+            waiting = 0;
+            for (size_t i = 1; i < n; i++) {
+                if (peek_frame_time_ns(blocks[i], last_uids[i]) <
+                    peek_frame_time_ns(blocks[waiting], last_uids[waiting]))
+                    waiting = i;
+            }
+        }
+        int exit_code = wait_for_new_frame(blocks[waiting], last_uids[waiting], block_thread);
+        if (exit_code != SUCCESS) return exit_code;
+    }
+}
+
 frame_t* create_frame() {
     frame_t* frame = (frame_t*)malloc(sizeof(frame_t));
-    frame->data = (unsigned char*)malloc(sizeof(unsigned char) * 8);
+    frame->data = NULL;
+    frame->capacity = 0;
+    frame->storage = FRAME_STORAGE_MALLOC;
     frame->frame_uid = 0ull;
+    frame->payload_size = 0;
+    frame->codec = CODEC_RAW;
+    return frame;
+}
+
+frame_t* create_frame_for_block(const block_t* block, bool page_aligned) {
+    frame_t* frame = create_frame();
+    if (page_aligned) frame->storage = FRAME_STORAGE_PAGE_ALIGNED;
+    reserve_frame(frame, block_payload_capacity(block));
+    return frame;
+}
+
+frame_t* create_frame_with_storage(image* data, size_t capacity) {
+    frame_t* frame = create_frame();
+    frame->data = data;
+    frame->capacity = capacity;
+    frame->storage = FRAME_STORAGE_CALLER;
     return frame;
 }
 
 void delete_frame(frame_t* ptr) {
-    free(ptr->data);
+    if (ptr->storage != FRAME_STORAGE_CALLER) free(ptr->data);
     free(ptr);
 }
 
@@ -198,15 +1878,241 @@ char* file_address_from_direction(const char* direction) {
     return file_address;
 }
 
+// Returns the address a buffer is set up at before it is published at [file_address]:
+// a hidden file next to it that no reader looks for.
+char* staging_address(const char* file_address) {
+    const char* name = strrchr(file_address, '/') + 1;
+    char* staging = (char*)malloc(strlen(file_address) + 32);
+    sprintf(staging, "%.*s.%s.%d", (int)(name - file_address), file_address, name, getpid());
+    return staging;
+}
+
 // this is a helper
-block_t* new_block(char* filename, buffer_t* buffer) {
+block_t* new_block(char* filename, buffer_t* buffer, size_t mapped_size) {
     block_t* new_block = (block_t*)malloc(sizeof(block_t));
     new_block->buffer = buffer;
+    new_block->mapped_size = mapped_size;
     new_block->filename = filename;
+    new_block->pending_slot = -1;
+    new_block->pending_uid = 0;
+    new_block->producer = false;
+    new_block->reader_slot = -1;
+    new_block->notify_fd = -1;
+    new_block->stats_unavailable = false;
+    new_block->level = 0;
+    new_block->adopted_slot = -1;
+    new_block->registry_entry = -1;
+    new_block->wait_policy = (wait_policy_t){.spin_ns = 0, .yield = false, .cpu = -1};
+    new_block->rate_start_ns = 0;
+    new_block->rate_start_frame = 0;
     return new_block;
 }
 
-block_t* create_block(const char* direction, size_t width, size_t height, size_t depth) {
+block_options_t default_block_options() {
+    block_options_t options = {
+        .slot_count = BUFFER_COUNT,
+        .sync_mode = SYNC_RWLOCK,
+        .page_mode = PAGES_DEFAULT,
+        .hugetlbfs_dir = NULL,
+        .lock_memory = false,
+        .prefault = false,
+        .numa_node = -1,
+        .stats = false,
+        .backpressure = BACKPRESSURE_OVERWRITE,
+        .max_payload_size = 0,
+        .pixel_format = PIXEL_FORMAT_U8,
+        .row_alignment = 0,
+        .derived_count = 0,
+        .multi_producer = false,
+        .timestamp_unit = TIMESTAMP_MILLISECONDS,
+    };
+    return options;
+}
+
+// Opens the file that backs the buffer at [file_address] and sizes it to hold at least
+// [bytes_needed] bytes, which is rounded up to whole huge pages if necessary. Buffers
+// that live on hugetlbfs are reachable through a symlink at [file_address], so readers
+// do not need to know where the buffer lives. Returns -1 on failure.
+int create_backing_file(const char* file_address, const char* direction,
+                        const block_options_t* options, size_t* bytes_needed) {
+    size_t huge_page_size = 0;
+    if (options->page_mode == PAGES_HUGETLB_2MB) huge_page_size = 2ul << 20;
+    if (options->page_mode == PAGES_HUGETLB_1GB) huge_page_size = 1ul << 30;
+
+    if (huge_page_size == 0) {
+        // file is open for read and write
+        // file owner has read, write, and execute permissions.
+        int buffer_file = open(file_address, O_RDWR | O_CREAT, S_IRWXU);
+        if (buffer_file == -1) {
+            fprintf(stderr, "Failed to open file \"%s\" with error: %s.", file_address, strerror(errno));
+            return -1;
+        }
+        if (ftruncate(buffer_file, *bytes_needed) == -1) {
+            fprintf(stderr, "Failed to truncate the file to the desired length: %s.", strerror(errno));
+            close(buffer_file);
+            remove(file_address);
+            return -1;
+        }
+        return buffer_file;
+    }
+
+    const char* hugetlbfs_dir = options->hugetlbfs_dir ? options->hugetlbfs_dir : HUGETLBFS_DIR;
+    char* huge_address = (char*)malloc(sizeof(char) * (strlen(hugetlbfs_dir) + strlen(direction) +
+                                                       strlen("/buffer-") + 1));
+    sprintf(huge_address, "%s/buffer-%s", hugetlbfs_dir, direction);
+
+    // the huge page size is a property of the mount, not of the file
+    struct statfs mount;
+    if (statfs(hugetlbfs_dir, &mount) == -1 || mount.f_type != HUGETLBFS_MAGIC ||
+        (size_t)mount.f_bsize != huge_page_size) {
+        fprintf(stderr, "\"%s\" is not a hugetlbfs mount with %zu byte pages.",
+                hugetlbfs_dir, huge_page_size);
+        free(huge_address);
+        return -1;
+    }
+
+    int buffer_file = open(huge_address, O_RDWR | O_CREAT | O_EXCL, S_IRWXU);
+    if (buffer_file == -1) {
+        fprintf(stderr, "Failed to open file \"%s\" with error: %s.", huge_address, strerror(errno));
+        free(huge_address);
+        return -1;
+    }
+    *bytes_needed = (*bytes_needed + huge_page_size - 1) / huge_page_size * huge_page_size;
+    if (ftruncate(buffer_file, *bytes_needed) == -1 || symlink(huge_address, file_address) == -1) {
+        fprintf(stderr, "Failed to set up huge page backed file \"%s\": %s.", huge_address,
+                strerror(errno));
+        close(buffer_file);
+        remove(huge_address);
+        free(huge_address);
+        return -1;
+    }
+    free(huge_address);
+    return buffer_file;
+}
+
+// Removes the file at [file_address] along with the hugetlbfs file it links to, if any.
+void remove_backing_file(const char* file_address) {
+    char huge_address[PATH_MAX];
+    ssize_t length = readlink(file_address, huge_address, sizeof(huge_address) - 1);
+    if (length != -1) {
+        huge_address[length] = '\0';
+        remove(huge_address);
+    }
+    remove(file_address);
+}
+
+// Applies the placement [options] to the freshly mapped, untouched [memory]. Pages have
+// to be bound to a NUMA node before they are first touched, or they stay where they
+// were faulted in.
+bool place_block_memory(void* memory, size_t size, const block_options_t* options) {
+    if (options->page_mode == PAGES_TRANSPARENT_HUGE && madvise(memory, size, MADV_HUGEPAGE) == -1)
+        fprintf(stderr, "Transparent huge pages are not available: %s.", strerror(errno));
+
+    if (options->numa_node >= 0) {
+        unsigned long nodemask[4] = {0};
+        size_t max_node = sizeof(nodemask) * CHAR_BIT;
+        if ((size_t)options->numa_node >= max_node) {
+            fprintf(stderr, "NUMA node %d is out of range.", options->numa_node);
+            return false;
+        }
+        nodemask[options->numa_node / (sizeof(unsigned long) * CHAR_BIT)] |=
+            1ul << (options->numa_node % (sizeof(unsigned long) * CHAR_BIT));
+        if (syscall(SYS_mbind, memory, size, MPOL_BIND, nodemask, max_node, MPOL_MF_MOVE) == -1) {
+            fprintf(stderr, "Failed to bind the buffer to NUMA node %d: %s.", options->numa_node,
+                    strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+// Faults in every page of [memory], so that the first frames do not pay for it.
+void prefault_memory(void* memory, size_t size, bool writable) {
+    if (madvise(memory, size, writable ? MADV_POPULATE_WRITE : MADV_POPULATE_READ) == 0)
+        return;
+
+    // kernels older than 5.14 do not know MADV_POPULATE_*, so touch every page instead.
+    // the memory is still zero-filled at this point.
+    long page_size = sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < size; offset += page_size) {
+        volatile unsigned char* page = (volatile unsigned char*)memory + offset;
+        if (writable)
+            *page = *page;
+        else
+            (void)*page;
+    }
+}
+
+// Describes the image of a slot and each of the derived levels in [options] in [levels],
+// and returns the number of bytes a slot needs for all of them. Returns 0 if the levels
+// cannot be derived.
+size_t init_image_levels(image_level_t* levels, size_t width, size_t height, size_t depth,
+                         const image_format_t* format, size_t slot_size,
+                         const block_options_t* options) {
+    memset(levels, 0, sizeof(image_level_t) * (MAX_DERIVED_LEVELS + 1));
+    levels[0].width = width;
+    levels[0].height = height;
+    levels[0].depth = depth;
+    levels[0].format = *format;
+    levels[0].scale = 1;
+
+    if (options->derived_count > MAX_DERIVED_LEVELS) {
+        fprintf(stderr, "A block can have at most %d derived levels.", MAX_DERIVED_LEVELS);
+        return 0;
+    }
+    if (options->derived_count > 0 && options->max_payload_size != 0) {
+        fprintf(stderr, "Blocks of variable-length payloads cannot have derived levels.");
+        return 0;
+    }
+    // every level starts on its own cache line
+    size_t extent = slot_size;
+    for (size_t i = 1; i <= options->derived_count; i++) {
+        image_level_t* level = &levels[i];
+        level->conversion = options->derived[i - 1].conversion;
+        level->scale = options->derived[i - 1].scale;
+        if (!converted_image_format(format, level->conversion, level->scale, &level->format))
+            return 0;
+        level->width = level->format.planes[0].width;
+        level->height = level->format.planes[0].height;
+        level->depth = level->format.planes[0].channels;
+        level->offset = round_up(extent, CACHE_LINE);
+        extent = level->offset + level->format.size;
+    }
+    return extent;
+}
+
+block_t* create_block(const char* direction, size_t width, size_t height, size_t depth,
+                      size_t slot_count) {
+    block_options_t options = default_block_options();
+    options.slot_count = slot_count;
+    return create_block_ex(direction, width, height, depth, &options);
+}
+
+block_t* create_block_ex(const char* direction, size_t width, size_t height, size_t depth,
+                         const block_options_t* options) {
+    size_t slot_count = options->slot_count;
+    if (slot_count == 0) {
+        fprintf(stderr, "A block needs to hold at least one image.");
+        return NULL;
+    }
+
+    image_format_t format;
+    if (!image_format_init(&format, options->pixel_format, width, height, depth,
+                           options->row_alignment))
+        return NULL;
+
+    // a dropped frame would leave a hole in the tickets of the producers
+    if (options->multi_producer && options->backpressure == BACKPRESSURE_SKIP) {
+        fprintf(stderr, "Blocks with several producers cannot drop frames.");
+        return NULL;
+    }
+
+    size_t slot_size = options->max_payload_size ? options->max_payload_size : format.size;
+    image_level_t levels[MAX_DERIVED_LEVELS + 1];
+    size_t slot_extent = init_image_levels(levels, width, height, depth, &format, slot_size,
+                                           options);
+    if (slot_extent == 0) return NULL;
+
     char* file_address = file_address_from_direction(direction);
     if (file_address == NULL) return NULL;
 
@@ -220,50 +2126,145 @@ block_t* create_block(const char* direction, size_t width, size_t height, size_t
         return NULL;
     }
 
-    // file is open for read and write
-    // file owner has read, write, and execute permissions.
-    int buffer_file = open(file_address, O_RDWR | O_CREAT, S_IRWXU);
-    size_t bytes_needed = buffer_size(width, height, depth);
+    // the buffer is set up under another name and linked into place once it is complete,
+    // so that readers waiting for it (see [wait_for_block]) can open it right away
+    char* staging = staging_address(file_address);
+    size_t bytes_needed = buffer_size(slot_extent, slot_count);
+    int buffer_file = create_backing_file(staging, direction, options, &bytes_needed);
     if (buffer_file == -1) {
-        fprintf(stderr, "Failed to open file \"%s\" with error: %s.", file_address, strerror(errno));
-        return NULL;
-    }
-    if (ftruncate(buffer_file, bytes_needed) == -1) {
-        fprintf(stderr, "Failed to truncate the file to the desired length: %s.", strerror(errno));
+        free(staging);
+        free(file_address);
         return NULL;
     }
 
     buffer_t* buffer = (buffer_t*)mmap(NULL, bytes_needed, PROT_READ | PROT_WRITE, MAP_SHARED,
                                        buffer_file, 0);
-
-    buffer->frame_cnt = 0ull;
     close(buffer_file);
+    if (buffer == MAP_FAILED || !place_block_memory(buffer, bytes_needed, options)) {
+        if (buffer == MAP_FAILED)
+            fprintf(stderr, "Failed to map \"%s\": %s.", file_address, strerror(errno));
+        else
+            munmap(buffer, bytes_needed);
+        remove_backing_file(staging);
+        free(staging);
+        free(file_address);
+        return NULL;
+    }
+
+    if (options->lock_memory && mlock(buffer, bytes_needed) == -1)
+        fprintf(stderr, "Failed to lock the buffer into memory: %s.", strerror(errno));
+    if (options->prefault) prefault_memory(buffer, bytes_needed, true);
+
+    buffer->layout_version = BUFFER_LAYOUT_VERSION;
+    atomic_init(&buffer->frame_cnt, 0ull);
     buffer->width = width;
     buffer->height = height;
     buffer->depth = depth;
+    buffer->format = format;
+    buffer->level_count = options->derived_count;
+    memcpy(buffer->levels, levels, sizeof(levels));
+    buffer->slot_count = slot_count;
+    buffer->image_offset = buffer_image_offset(slot_count);
+    buffer->slot_size = slot_size;
+    buffer->slot_stride = buffer_slot_stride(slot_extent);
+    buffer->sync_mode = options->sync_mode;
+    buffer->prefault = options->prefault;
+    buffer->stats = options->stats;
+    buffer->backpressure = options->backpressure;
+    buffer->multi_producer = options->multi_producer;
+    buffer->timestamp_unit = options->timestamp_unit;
+    atomic_init(&buffer->ticket, 0ull);
     buffer->owner = getpid();
+    atomic_init(&buffer->generation, 0u);
     buffer->is_alive = true;
 
-    pthread_condattr_t attrcond;
-    pthread_condattr_init(&attrcond);
-    pthread_condattr_setpshared(&attrcond, PTHREAD_PROCESS_SHARED);
-    pthread_cond_init(&buffer->cond, &attrcond);
+    atomic_init(&buffer->writer_stats.lock_wait_ns, 0ull);
+    atomic_init(&buffer->writer_stats.copy_ns, 0ull);
+    atomic_init(&buffer->frames_dropped, 0ull);
+    atomic_init(&buffer->cursor_signal, 0u);
+    atomic_init(&buffer->writer_waiting, 0u);
+    atomic_init(&buffer->reliable_count, 0u);
+    atomic_init(&buffer->frame_signal, 0u);
+    atomic_init(&buffer->waiters, 0u);
+
+    for (size_t i = 0; i < slot_count; i++) {
+        atomic_init(&buffer->metadata[i].frame_uid, 0ull);
+        atomic_init(&buffer->metadata[i].acquisition_time, 0ull);
+        atomic_init(&buffer->metadata[i].payload_size, 0ull);
+        atomic_init(&buffer->metadata[i].codec, CODEC_RAW);
+        atomic_init(&buffer->metadata[i].seq, 0ull);
+        atomic_init(&buffer->metadata[i].lock, 0u);
+        atomic_init(&buffer->metadata[i].committed_uid, 0ull);
+    }
+
+    // readers only accept the buffer once it is completely set up
+    atomic_thread_fence(memory_order_release);
+    buffer->magic = BUFFER_MAGIC;
+
+    // unlike rename, link fails if another writer published a buffer of the same name
+    // in the meantime
+    if (link(staging, file_address) == -1) {
+        fprintf(stderr, "Failed to publish buffer \"%s\": %s.", file_address, strerror(errno));
+        munmap(buffer, bytes_needed);
+        remove_backing_file(staging);
+        free(staging);
+        free(file_address);
+        return NULL;
+    }
+    unlink(staging);
+    free(staging);
+
+    block_t* block = new_block(file_address, buffer, bytes_needed);
+    register_block(block);
+    return block;
+}
 
-    pthread_mutexattr_t attrmutex;
-    pthread_mutexattr_init(&attrmutex);
-    pthread_mutexattr_setpshared(&attrmutex, PTHREAD_PROCESS_SHARED);
-    pthread_mutex_init(&buffer->cond_mutex, &attrmutex);
+// Returns true if [a] and [b] lay images out in the same way.
+bool same_image_format(const image_format_t* a, const image_format_t* b) {
+    if (a->pixel_format != b->pixel_format || a->plane_count != b->plane_count ||
+        a->size != b->size)
+        return false;
+    for (size_t i = 0; i < a->plane_count; i++) {
+        const plane_t* p = &a->planes[i];
+        const plane_t* q = &b->planes[i];
+        if (p->offset != q->offset || p->width != q->width || p->height != q->height ||
+            p->channels != q->channels || p->stride != q->stride)
+            return false;
+    }
+    return true;
+}
 
-    pthread_rwlockattr_t attrrwlock;
-    pthread_rwlockattr_init(&attrrwlock);
-    pthread_rwlockattr_setpshared(&attrrwlock, PTHREAD_PROCESS_SHARED);
-    for (int i = 0; i < BUFFER_COUNT; i++)
-        pthread_rwlock_init(&buffer->metadata[i].rwlock, &attrrwlock);
+block_t* create_block_with_format(const char* direction, size_t width, size_t height,
+                                  size_t depth, const image_format_t* format,
+                                  size_t payload_capacity, const block_options_t* options) {
+    block_options_t like = *options;
+    like.pixel_format = format->pixel_format;
+    like.max_payload_size = payload_capacity != format->size ? payload_capacity : 0;
 
-    return new_block(file_address, buffer);
+    // the row alignment that produced [format] is found again by trying every one up to
+    // a page. Images that cannot be laid out at all are not tried again.
+    image_format_t candidate;
+    bool found = false;
+    for (size_t alignment = 0; alignment <= 4096 && !found;
+         alignment = alignment ? 2 * alignment : 2) {
+        if (!image_format_init(&candidate, format->pixel_format, width, height, depth,
+                               alignment))
+            return NULL;
+        found = same_image_format(&candidate, format);
+        like.row_alignment = alignment;
+    }
+    if (!found) {
+        fprintf(stderr, "Images laid out as requested cannot be held by a block.");
+        return NULL;
+    }
+    return create_block_ex(direction, width, height, depth, &like);
 }
 
 block_t* open_block(const char* direction) {
+    return open_block_level(direction, 0);
+}
+
+block_t* open_block_level(const char* direction, size_t level) {
     char* file_address = file_address_from_direction(direction);
 
     // assert file_preconditions
@@ -277,18 +2278,142 @@ block_t* open_block(const char* direction) {
 
     if (buffer_file == -1) {
         fprintf(stderr, "Failed to create block access point because file \"%s\" dne.", file_address);
+        free(file_address);
         return NULL;
     }
 
     size_t bytes_needed = lseek(buffer_file, 0, SEEK_END);
+    if (bytes_needed < sizeof(buffer_t)) {
+        fprintf(stderr, "File \"%s\" is too small to hold a buffer.", file_address);
+        close(buffer_file);
+        free(file_address);
+        return NULL;
+    }
     buffer_t* buffer = (buffer_t*)mmap(NULL, bytes_needed, PROT_READ | PROT_WRITE, MAP_SHARED,
                                        buffer_file, 0);
+    close(buffer_file);
+    if (buffer == MAP_FAILED) {
+        fprintf(stderr, "Failed to map \"%s\": %s.", file_address, strerror(errno));
+        free(file_address);
+        return NULL;
+    }
+    if (buffer->magic != BUFFER_MAGIC || buffer->layout_version != BUFFER_LAYOUT_VERSION) {
+        fprintf(stderr, "Buffer \"%s\" has layout version %u, expected %u.", file_address,
+                buffer->magic == BUFFER_MAGIC ? buffer->layout_version : 0u,
+                BUFFER_LAYOUT_VERSION);
+        munmap(buffer, bytes_needed);
+        free(file_address);
+        return NULL;
+    }
+    if (level > buffer->level_count) {
+        fprintf(stderr, "Buffer \"%s\" has no level %zu.", file_address, level);
+        munmap(buffer, bytes_needed);
+        free(file_address);
+        return NULL;
+    }
+    // the writer faulted its pages in already, this only fills in our page tables
+    if (buffer->prefault) prefault_memory(buffer, bytes_needed, false);
+
+    block_t* block = new_block(file_address, buffer, bytes_needed);
+    block->level = level;
+    return block;
+}
+
+block_t* wait_for_block(const char* direction, size_t level, int timeout_ms) {
+    char* file_address = file_address_from_direction(direction);
+    if (file_address == NULL) return NULL;
+
+    // the directory is watched before the first attempt, so that a buffer that is
+    // published in between cannot be missed
+    char* name = strrchr(file_address, '/') + 1;
+    name[-1] = '\0';
+    int watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch == -1 || inotify_add_watch(watch, file_address, IN_CREATE | IN_MOVED_TO) == -1) {
+        fprintf(stderr, "Failed to watch \"%s\": %s.", file_address, strerror(errno));
+        if (watch != -1) close(watch);
+        free(file_address);
+        return NULL;
+    }
+    name[-1] = '/';
+
+    uint64_t deadline = monotonic_ns() + (uint64_t)timeout_ms * 1000000ull;
+    block_t* block = NULL;
+    bool appeared = access(file_address, F_OK) == 0;
+    while (true) {
+        // a buffer that cannot be opened, e.g. one of another layout version, is
+        // retried once it is replaced
+        if (appeared && (block = open_block_level(direction, level)) != NULL) break;
+        appeared = false;
+
+        int remaining = -1;
+        if (timeout_ms >= 0) {
+            uint64_t now = monotonic_ns();
+            if (now >= deadline) break;
+            remaining = (deadline - now + 999999) / 1000000;
+        }
+        struct pollfd ready = {.fd = watch, .events = POLLIN};
+        if (poll(&ready, 1, remaining) == -1 && errno != EINTR) break;
 
-    return new_block(file_address, buffer);
+        // only events about the buffer itself are of interest
+        char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t length;
+        while ((length = read(watch, events, sizeof(events))) > 0) {
+            for (char* event = events; event < events + length;) {
+                struct inotify_event* entry = (struct inotify_event*)event;
+                if (entry->len > 0 && strcmp(entry->name, name) == 0) appeared = true;
+                event += sizeof(struct inotify_event) + entry->len;
+            }
+        }
+    }
+    close(watch);
+    free(file_address);
+    return block;
+}
+
+void block_stats(const block_t* block, block_stats_t* stats) {
+    buffer_t* buffer = block->buffer;
+    memset(stats, 0, sizeof(block_stats_t));
+    stats->width = buffer->width;
+    stats->height = buffer->height;
+    stats->depth = buffer->depth;
+    stats->slot_count = buffer->slot_count;
+    stats->sync_mode = buffer->sync_mode;
+    stats->backpressure = buffer->backpressure;
+    stats->owner = buffer->owner;
+    stats->generation = atomic_load(&buffer->generation);
+    stats->is_alive = buffer->is_alive;
+    stats->enabled = buffer->stats;
+    stats->frames_written = atomic_load_explicit(&buffer->frame_cnt, memory_order_relaxed);
+    stats->frames_dropped = atomic_load_explicit(&buffer->frames_dropped, memory_order_relaxed);
+    // the counters simply stay 0 if the buffer does not collect stats
+    stats->write_lock_wait_ns = atomic_load_explicit(&buffer->writer_stats.lock_wait_ns,
+                                                     memory_order_relaxed);
+    stats->write_copy_ns = atomic_load_explicit(&buffer->writer_stats.copy_ns,
+                                                memory_order_relaxed);
+    for (int i = 0; i < MAX_READERS; i++) {
+        reader_slot_t* reader = &buffer->readers[i];
+        pid_t pid = atomic_load(&reader->pid);
+        if (pid == 0) continue;
+
+        reader_stats_t* reader_stats = &stats->readers[stats->reader_count++];
+        reader_stats->pid = pid;
+        reader_stats->cursor = atomic_load_explicit(&reader->cursor, memory_order_relaxed);
+        reader_stats->reliable = atomic_load_explicit(&reader->reliable, memory_order_relaxed);
+        reader_stats->frames_read = atomic_load_explicit(&reader->frames_read,
+                                                         memory_order_relaxed);
+        reader_stats->frames_skipped = atomic_load_explicit(&reader->frames_skipped,
+                                                            memory_order_relaxed);
+        reader_stats->frame_wait_ns = atomic_load_explicit(&reader->frame_wait_ns,
+                                                           memory_order_relaxed);
+        reader_stats->lock_wait_ns = atomic_load_explicit(&reader->lock_wait_ns,
+                                                          memory_order_relaxed);
+        reader_stats->copy_ns = atomic_load_explicit(&reader->copy_ns, memory_order_relaxed);
+    }
 }
 
 bool cstr_block_is_poisoned(const char* direction) {
     block_t* block = open_block(direction);
+    if (block == NULL) return false;
     bool result = block_is_poisoned(block);
     close_block(block);
     return result;
@@ -307,6 +2432,7 @@ bool block_is_poisoned(const block_t* block) {
 
 bool cstr_block_is_alive(const char* direction) {
     block_t* block = open_block(direction);
+    if (block == NULL) return false;
     bool result = block_is_alive(block);
     close_block(block);
     return result;
@@ -316,17 +2442,72 @@ bool block_is_alive(const block_t* block) {
     return block->buffer->is_alive;
 }
 
+// Frees [block] and unmaps its buffer, see [close_block].
+void unmap_block(block_t* block) {
+    release_reader_slot(block);
+    if (block->notify_fd != -1) close(block->notify_fd);
+    munmap(block->buffer, block->mapped_size);
+    free(block->filename);
+    free(block);
+}
+
 void close_block(block_t* block) {
     buffer_t* buffer = block->buffer;
-    if (buffer->owner == getpid()) {
+    if (buffer->owner == getpid() && !block->producer) {
         fprintf(stderr,
                 "The current process with PID: %d owns the unlying buffer at %s.\
 please call \"destroy_block\" instead.",
                 getpid(), block->filename);
         return;
     }
-    free(block->filename);
-    free(block);
+    unmap_block(block);
+}
+
+block_t* open_block_producer(const char* direction) {
+    block_t* block = open_block(direction);
+    if (block == NULL) return NULL;
+    if (!block->buffer->multi_producer) {
+        fprintf(stderr, "Buffer at %s only accepts frames from its owner.", block->filename);
+        unmap_block(block);
+        return NULL;
+    }
+    block->producer = true;
+    return block;
+}
+
+block_t* reclaim_block(const char* direction) {
+    block_t* block = open_block(direction);
+    if (block == NULL) return NULL;
+
+    // writers that restart at the same time race for the buffer, only one of them wins
+    buffer_t* buffer = block->buffer;
+    pid_t owner = atomic_load(&buffer->owner);
+    if (!block_is_poisoned(block) ||
+        !atomic_compare_exchange_strong(&buffer->owner, &owner, getpid())) {
+        fprintf(stderr, "Buffer at %s has a live owner and cannot be reclaimed.",
+                block->filename);
+        unmap_block(block);
+        return NULL;
+    }
+
+    // the previous writer may have died waiting for readers or holding the next slot, but
+    // every frame it committed is intact. Other producers may still be waiting
+    if (!buffer->multi_producer) atomic_store(&buffer->writer_waiting, 0);
+    int next_slot = (atomic_load(&buffer->frame_cnt) + 1) % buffer->slot_count;
+    frame_metadata_t* metadata = &buffer->metadata[next_slot];
+    // a held slot of a multi_producer block may belong to a live producer, so it is left
+    // alone there
+    if (!buffer->multi_producer &&
+        (buffer->sync_mode == SYNC_SEQLOCK ? atomic_load(&metadata->seq) & 1
+                                           : atomic_load(&metadata->lock) & SLOT_WRITER))
+        block->adopted_slot = next_slot;
+    atomic_fetch_add(&buffer->generation, 1);
+    register_block(block);
+    return block;
+}
+
+uint32_t block_generation(const block_t* block) {
+    return atomic_load(&block->buffer->generation);
 }
 
 void destroy_block(block_t* block) {
@@ -340,6 +2521,7 @@ void destroy_block(block_t* block) {
                 getpid(),
                 block->filename,
                 block->buffer->owner);
+        return;
     }
 
     // kill!
@@ -351,8 +2533,6 @@ void destroy_block(block_t* block) {
     buffer->is_alive = false;
 
     // start destruction process
-    pthread_mutex_lock(&buffer->cond_mutex);
-
     // rename the filename so processes cannot access it during this vulnerable state
     char* archived = "-archived-random-name-so-no-direction-can-ever-be-like-this";
     char* new_filename = (char*)
@@ -366,14 +2546,17 @@ void destroy_block(block_t* block) {
                 block->filename);
     }
 
-    pthread_cond_broadcast(&buffer->cond);
-    pthread_mutex_unlock(&buffer->cond_mutex);
+    signal_watchers(buffer);
+    notify_readers(block);
+    unregister_block(block->filename + strlen(BLOCK_DIR));
 
-    // sleep for 1 second to allow all watcher threads to clean up
-    munmap(buffer, buffer_size(buffer->width, buffer->height,
-                               buffer->depth));
-    remove(new_filename);  // buffer does not exist after this
+    // readers do not need to be waited for: their own mappings keep the memory of the
+    // buffer alive until they close their blocks, so one that is still copying a frame
+    // finishes it, and then sees that the block is no longer active
+    munmap(buffer, block->mapped_size);
+    remove_backing_file(new_filename);  // buffer does not exist after this
     free(new_filename);
+    if (block->notify_fd != -1) close(block->notify_fd);
     free(block->filename);
     free(block);
 }
\ No newline at end of file
@@ -16,14 +16,18 @@ extern "C" {
  *          read/write process must have a block structure.
  *
  *      2. buffer_t: Refers to the frame buffer. Contains raw image data and
- *          metadata. It maintains a “master” mutex that all read/write processes
- *          need to interact with. For each frame, it also maintains a frame mutex
- *          which is a pthread rwlock t. This way, the resource allows for multiple
+ *          metadata. It maintains a “master” frame signal (a futex word) that readers
+ *          sleep on and the writer bumps with every frame. For each frame, it also maintains a frame mutex
+ *          which is a reader-writer lock built on a futex word. This way, the resource allows for multiple
  *          readers at the same time when the data is not being written to.
  *          Buffers are unique. There can only be one buffer of the same name
  *          located at /dev/shm/. Buffers have only 1 owner. Only the owner has
  *          write access. All other processes only have read capabilities. This is
  *          enforced using PIDs.
+ *          Every image starts on a page boundary (a 64 byte boundary for images smaller
+ *          than a page), and fields written by different processes live on separate
+ *          cache lines. The layout is versioned, so a reader built against a different
+ *          layout refuses to open the buffer.
 
  *          The buffer is located on /dev/shm/ because that directory is a TPFS
  *          mounted on RAM. This allows for lightning-fast read/write operations
@@ -33,9 +37,14 @@ extern "C" {
  *      3. frame_t: represents a single frame. Contains image dimensions, acquisition time,
  *          and raw image data. (exposed to client)
  *
+ *      4. frame_view_t: a read-only view of a frame that still lives inside the buffer.
+ *          The view holds the read lock of its slot until it is released, so no
+ *          image data is copied. (exposed to client)
+ *
  * learn about mutexes here
  *      - http://www.cs.kent.edu/~ruttan/sysprog/lectures/multi-thread/pthread_cond_init.html
  *      - https://docs.oracle.com/cd/E19455-01/806-5257/6je9h032u/index.html
+ *      - https://man7.org/linux/man-pages/man2/futex.2.html
  *
  */
 
@@ -43,12 +52,76 @@ extern "C" {
 #include <stdint.h>
 #include <sys/types.h>
 
-// The number of images held in a buffer.
+// The default number of images held in a buffer. Deeper buffers let slow readers fall
+// further behind before frames are skipped, shallower ones keep latency low.
 #define BUFFER_COUNT 3
 
 // where to store the buffer
 #define BLOCK_DIR "/dev/shm/buffer-"
 
+// where the registry of the blocks on this machine is stored, see [list_blocks]
+#define REGISTRY_ADDRESS "/dev/shm/framebuffer-registry"
+
+// where buffers backed by explicit huge pages are stored by default. [BLOCK_DIR]-[direction]
+// is a symlink to the file in that case.
+#define HUGETLBFS_DIR "/dev/hugepages"
+
+// pages that back a buffer
+//  - PAGES_DEFAULT: regular pages of the tmpfs at [BLOCK_DIR]
+//  - PAGES_TRANSPARENT_HUGE: same as above, but advised to use transparent huge pages.
+//      Only takes effect if /sys/kernel/mm/transparent_hugepage/shmem_enabled allows it
+//  - PAGES_HUGETLB_2MB, PAGES_HUGETLB_1GB: explicit huge pages on a hugetlbfs mount
+//      with the matching page size. The pages must be reserved up front
+//      (/proc/sys/vm/nr_hugepages), and the buffer is rounded up to whole pages.
+#define PAGES_DEFAULT 0
+#define PAGES_TRANSPARENT_HUGE 1
+#define PAGES_HUGETLB_2MB 2
+#define PAGES_HUGETLB_1GB 3
+
+// The maximum number of readers of a block that can register for notifications.
+#define MAX_READERS 32
+
+// protocols that keep readers from seeing a slot while it is being written
+//  - SYNC_RWLOCK: every slot has a futex lock word that counts its readers and has the
+//      SLOT_WRITER bit set while it is written. Readers never see a torn frame, but the
+//      writer waits for readers that hold the slot it writes to. A restarted writer can
+//      reclaim a slot that its crashed predecessor held.
+//  - SYNC_SEQLOCK: every slot has a sequence number that is odd while it is being
+//      written. The writer never waits. Readers copy optimistically and retry when the
+//      slot changed underneath them.
+#define SYNC_RWLOCK 0
+#define SYNC_SEQLOCK 1
+
+// what the writer does when the frame it is about to write would overwrite a frame that a
+// reliable reader (see [register_reader]) has not read yet. Best-effort readers never
+// hold the writer back, they skip ahead like all readers do with BACKPRESSURE_OVERWRITE.
+//  - BACKPRESSURE_OVERWRITE: overwrite it anyway, so slow readers skip frames
+//  - BACKPRESSURE_BLOCK: wait until every reliable reader read it. Reliable readers that
+//      die stop holding the writer back shortly after their process is gone
+//  - BACKPRESSURE_SKIP: drop the new frame instead, [write_frame] returns FRAME_DROPPED
+#define BACKPRESSURE_OVERWRITE 0
+#define BACKPRESSURE_BLOCK 1
+#define BACKPRESSURE_SKIP 2
+
+// units of the acquisition times that the writer of a block passes along with its frames.
+// The library only needs them to compare the frames of different blocks, see
+// [read_synced].
+//  - TIMESTAMP_MILLISECONDS: the default
+//  - TIMESTAMP_NANOSECONDS: e.g. CLOCK_REALTIME or the hardware timestamps of a camera
+#define TIMESTAMP_MILLISECONDS 0
+#define TIMESTAMP_NANOSECONDS 1
+
+// codec tags, which describe how the payload of a frame is encoded. Any other four
+// character code (see [FOURCC]) may be used as well, the library only passes it along.
+//  - CODEC_RAW: an uncompressed image of the block's width * height * depth bytes
+#define FOURCC(a, b, c, d) \
+    ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define CODEC_RAW 0
+#define CODEC_JPEG FOURCC('M', 'J', 'P', 'G')
+#define CODEC_H264 FOURCC('H', '2', '6', '4')
+#define CODEC_H265 FOURCC('H', 'E', 'V', 'C')
+#define CODEC_LZ4 FOURCC('L', 'Z', '4', ' ')
+
 // A frame is a long array of characters. Each character is 1 byte, which perfectly represents
 // a pixel value [0,255].
 typedef unsigned char image;
@@ -56,40 +129,301 @@ typedef unsigned char image;
 typedef struct buffer buffer_t;
 typedef struct block block_t;
 
+// types of the elements (channel values) of an image
+#define ELEMENT_U8 0
+#define ELEMENT_U16 1
+#define ELEMENT_F32 2
+
+// pixel formats of the images held in a block
+//  - PIXEL_FORMAT_U8: [depth] interleaved 8 bit channels, e.g. BGR (the default)
+//  - PIXEL_FORMAT_U16: [depth] interleaved 16 bit channels, e.g. a depth camera
+//  - PIXEL_FORMAT_F32: [depth] interleaved 32 bit float channels, e.g. model outputs
+//  - PIXEL_FORMAT_NV12: an 8 bit luma plane followed by a half resolution plane of
+//      interleaved U and V, as produced by most hardware decoders. [depth] is ignored
+//  - PIXEL_FORMAT_I420: an 8 bit luma plane followed by half resolution U and V planes.
+//      [depth] is ignored
+#define PIXEL_FORMAT_U8 0
+#define PIXEL_FORMAT_U16 1
+#define PIXEL_FORMAT_F32 2
+#define PIXEL_FORMAT_NV12 3
+#define PIXEL_FORMAT_I420 4
+
+#define MAX_PLANES 3
+
+// A plane of an image. Rows are [stride] bytes apart, which is at least
+// [width] * [channels] elements.
+typedef struct plane {
+    size_t offset;  // bytes from the start of the image
+    size_t width, height;
+    size_t channels;  // interleaved channels per pixel
+    size_t stride;
+} plane_t;
+
+// Describes how an image is laid out in memory, see [image_format_init].
+typedef struct image_format {
+    int pixel_format;  // one of the PIXEL_FORMAT_* values
+    int element_type;  // one of the ELEMENT_* values
+    size_t element_size;
+    size_t plane_count;
+    plane_t planes[MAX_PLANES];
+    size_t size;  // bytes of the whole image
+} image_format_t;
+
+// Describes images of [pixel_format] with [width] * [height] pixels of [depth] channels
+// in [format]. Planes are stored one after the other. Every row (and with that every
+// plane) starts on a multiple of [row_alignment] bytes, 0 packs rows without padding.
+// Chroma planes of odd sized images are rounded up. Returns false for an unknown
+// [pixel_format] and for images whose size does not fit into a size_t.
+//
+//  usage:
+//      image_format_t nv12;
+//      image_format_init(&nv12, PIXEL_FORMAT_NV12, 1920, 1080, 1, 64);
+//      const image* uv = image + nv12.planes[1].offset;
+bool image_format_init(image_format_t* format, int pixel_format, size_t width,
+                       size_t height, size_t depth, size_t row_alignment);
+
+// Returns true if [a] and [b] lay images out in the same way.
+bool same_image_format(const image_format_t* a, const image_format_t* b);
+
+// conversions applied by [convert_image] and [read_frame_converted] to images of
+// PIXEL_FORMAT_U8
+//  - CONVERT_COPY: keep the channels as they are
+//  - CONVERT_BGR_TO_RGB: reverse the order of 3 channels
+//  - CONVERT_BGR_TO_GRAY: 1 channel of BT.601 luma, matching cv2.COLOR_BGR2GRAY
+#define CONVERT_COPY 0
+#define CONVERT_BGR_TO_RGB 1
+#define CONVERT_BGR_TO_GRAY 2
+
+// Describes the images [convert_image] makes of images in [format] in [converted]: packed
+// rows of [width] / [scale] * [height] / [scale] pixels. Returns false if [format] cannot be
+// converted, which is the case for anything but PIXEL_FORMAT_U8, a [scale] other than 1, 2
+// or 4, and colour conversions of images that do not have 3 channels.
+bool converted_image_format(const image_format_t* format, int conversion, size_t scale,
+                            image_format_t* converted);
+
+// Converts the image at [source], laid out as described by [format], with [conversion]
+// and downscales it by [scale] with a box filter, i.e. every pixel of [destination] is
+// the rounded average of [scale] * [scale] source pixels. Rows and columns that do not
+// make up a whole box are dropped. [destination] must hold the size given by
+// [converted_image_format].
+//
+//  usage:
+//      image_format_t small;
+//      converted_image_format(&view.format, CONVERT_BGR_TO_GRAY, 4, &small);
+//      image* thumbnail = malloc(small.size);
+//      convert_image(view.data, &view.format, thumbnail, CONVERT_BGR_TO_GRAY, 4);
+void convert_image(const image* source, const image_format_t* format, image* destination,
+                   int conversion, size_t scale);
+
+// The maximum number of derived levels of a block, see [block_options_t].
+#define MAX_DERIVED_LEVELS 4
+
+// A level of a block that the writer derives from every frame it writes, see
+// [convert_image].
+typedef struct derived_level {
+    int conversion;  // one of the CONVERT_* values
+    size_t scale;    // 1, 2 or 4
+} derived_level_t;
+
+// where the image data of a frame_t comes from
+//  - FRAME_STORAGE_MALLOC: allocated (and grown) by the library
+//  - FRAME_STORAGE_PAGE_ALIGNED: same as above, but aligned to a page boundary
+//  - FRAME_STORAGE_CALLER: supplied by the caller, never grown or freed by the library
+#define FRAME_STORAGE_MALLOC 0
+#define FRAME_STORAGE_PAGE_ALIGNED 1
+#define FRAME_STORAGE_CALLER 2
+
+// A zero-initialized frame_t is equivalent to the one returned by [create_frame].
+// [payload_size] bytes at [data] hold the frame, encoded as described by [codec]. For
+// CODEC_RAW frames that is the whole image, laid out as described by [format]. For other
+// codecs the dimensions and [format] only describe the decoded image.
 typedef struct frame {
     size_t width, height, depth;
     uint64_t acquisition_time;
     uint64_t frame_uid;
     image* data;
+    size_t capacity;  // bytes available at [data]
+    int storage;      // one of the FRAME_STORAGE_* values
+    size_t payload_size;
+    uint32_t codec;   // one of the CODEC_* tags
+    image_format_t format;
 } frame_t;
 
+// A frame_view must be zero-initialized before its first use. [data] points directly
+// into the shared buffer and is only valid until the view is released.
+typedef struct frame_view {
+    size_t width, height, depth;
+    uint64_t acquisition_time;
+    uint64_t frame_uid;
+    const image* data;
+    int slot;      // private: the slot whose read lock is held by this view
+    uint64_t seq;  // private: sequence number of the slot when the view was acquired
+    size_t payload_size;
+    uint32_t codec;
+    image_format_t format;
+} frame_view_t;
+
+// Options used when creating a block. Obtain the defaults from [default_block_options]
+// and override the fields that matter.
+//  - slot_count: the number of images held in the buffer
+//  - sync_mode: one of the SYNC_* protocols
+//  - page_mode: one of the PAGES_* values
+//  - hugetlbfs_dir: the hugetlbfs mount for PAGES_HUGETLB_*, NULL for [HUGETLBFS_DIR]
+//  - lock_memory: mlock the buffer so that it is never swapped out (see RLIMIT_MEMLOCK)
+//  - prefault: fault in every page up front, for the writer as well as every reader, so
+//      that the first frames do not pay for page faults
+//  - numa_node: bind the buffer's memory to this NUMA node, -1 to use the default policy
+//  - stats: collect the counters reported by [block_stats]. Costs a few clock reads and
+//      atomic increments per frame, and every reader claims one of [MAX_READERS] slots
+//  - backpressure: one of the BACKPRESSURE_* policies
+//  - max_payload_size: 0 for blocks of raw images. Else every slot holds a variable-length
+//      payload of up to this many bytes, e.g. a JPEG image or an H.264 access unit
+//      written with [write_packet]. The dimensions of the block then describe the decoded
+//      images
+//  - pixel_format: one of the PIXEL_FORMAT_* values
+//  - row_alignment: pad every row of an image to a multiple of this many bytes, e.g. the
+//      pitch a decoder or GPU expects. 0 packs rows without padding. [write_frame] then
+//      takes images with padded rows, see [block_image_format]
+//  - derived_count, derived: levels the writer computes from every frame, e.g. a half
+//      resolution or grayscale version, before the frame is published. They are stored in
+//      the frame's slot and read through [open_block_level], so readers that want the
+//      same smaller image share the work. Only blocks of raw PIXEL_FORMAT_U8 images
+//      support them
+//  - multi_producer: let several threads or processes write frames to the block, see
+//      [open_block_producer]. Frames are numbered in the order their writes begin and
+//      published in that order. BACKPRESSURE_SKIP is not supported
+//  - timestamp_unit: one of the TIMESTAMP_* units of the acquisition times of frames
+typedef struct block_options {
+    size_t slot_count;
+    int sync_mode;
+    int page_mode;
+    const char* hugetlbfs_dir;
+    bool lock_memory;
+    bool prefault;
+    int numa_node;
+    bool stats;
+    int backpressure;
+    size_t max_payload_size;
+    int pixel_format;
+    size_t row_alignment;
+    size_t derived_count;
+    derived_level_t derived[MAX_DERIVED_LEVELS];
+    bool multi_producer;
+    int timestamp_unit;
+} block_options_t;
+
+// Counters of a single reader process, see [block_stats]. Times are in nanoseconds.
+//  - frames_skipped: frames the reader never saw because they were overwritten (or, in
+//      SYNC_SEQLOCK mode, were being overwritten) before it got to them
+//  - frame_wait_ns: time spent blocked waiting for new frames, spinning included
+//  - lock_wait_ns: time spent waiting for the writer to release a slot (SYNC_RWLOCK only)
+//  - copy_ns: time spent copying images out of the buffer
+//  - cursor: the newest frame the reader is done with
+//  - reliable: whether the reader registered as reliable, see [register_reader]
+typedef struct reader_stats {
+    pid_t pid;
+    uint64_t cursor;
+    bool reliable;
+    uint64_t frames_read;
+    uint64_t frames_skipped;
+    uint64_t frame_wait_ns;
+    uint64_t lock_wait_ns;
+    uint64_t copy_ns;
+} reader_stats_t;
+
+// A snapshot of a block and its counters, see [block_stats]. Times are in nanoseconds.
+//  - enabled: whether the block was created with the [stats] option. If not, the
+//      counters that are only collected with [stats] are 0
+//  - frames_dropped: frames the writer dropped because of BACKPRESSURE_SKIP
+//  - write_lock_wait_ns: time the writer spent waiting for readers to release the slot
+//      it writes to next, or to read the frame held by it (BACKPRESSURE_BLOCK)
+//  - write_copy_ns: time [write_frame] spent copying images into the buffer, and time
+//      spent computing derived levels
+//  - generation: the number of times the block was reclaimed, see [reclaim_block]
+//  - readers: the first [reader_count] entries describe the readers currently attached
+typedef struct block_stats {
+    size_t width, height, depth;
+    size_t slot_count;
+    int sync_mode;
+    int backpressure;
+    pid_t owner;
+    uint32_t generation;
+    bool is_alive;
+    bool enabled;
+    uint64_t frames_written;
+    uint64_t frames_dropped;
+    uint64_t write_lock_wait_ns;
+    uint64_t write_copy_ns;
+    size_t reader_count;
+    reader_stats_t readers[MAX_READERS];
+} block_stats_t;
+
 /* ############################################################################
  * The following section deals with block_t management. One may create or destroy
  * blocks, register readers for existing blocks, and recover poisoned blocks.
  *
  * Important note 1: if the *owner* of the block crashes (ungracefully), the
  * block is now known as *poisoned* if a reader of the block crashes, the block
- * remains healthy. Poisoned blocks must be deleted and recreated!
+ * remains healthy. A restarted writer takes over a poisoned block with
+ * [reclaim_block], which its readers do not even need to notice.
  * ############################################################################
  */
 
 // Allocates a new [block_t] struct with name [direction] backed by a mmap [buffer_t]
 // located at [BLOCK_DIR]-[direction]. Memory is allocated for this buffer and the
 // caller of this function will be set as the owner`. The buffer will hold
-// [BUFFER_COUNT] images, each of size [width] * [height] * [depth] bytes.
+// [slot_count] images, each of size [width] * [height] * [depth] bytes.
 //
 // Preconditions:
 //  - [direction] cannot have a "/" character and there must not be an existing block
 //      located at [BLOCK_DIR]-[direction]
+//  - [slot_count] is at least 1
 //
 //  usage:
-//      block_t* forward = create_block("forward");
+//      block_t* forward = create_block("forward", 640, 480, 3, BUFFER_COUNT);
 //      <...omitted...>
 //      destroy_block(forward):
-block_t* create_block(const char* direction, size_t width, size_t height, size_t depth);
+block_t* create_block(const char* direction, size_t width, size_t height, size_t depth,
+                      size_t slot_count);
+
+// Same as [create_block], but with every creation option specified in [options].
+//
+//  usage:
+//      block_options_t options = default_block_options();
+//      options.sync_mode = SYNC_SEQLOCK;
+//      block_t* forward = create_block_ex("forward", 640, 480, 3, &options);
+block_t* create_block_ex(const char* direction, size_t width, size_t height, size_t depth,
+                         const block_options_t* options);
+
+// Same as [create_block_ex], but the images of the block are laid out exactly as
+// described by [format] and its slots hold [payload_capacity] bytes, e.g. to recreate a
+// block recorded or received from another host. The pixel format, row alignment and
+// payload size of [options] are ignored. Returns NULL if no row alignment produces
+// [format].
+block_t* create_block_with_format(const char* direction, size_t width, size_t height,
+                                  size_t depth, const image_format_t* format,
+                                  size_t payload_capacity, const block_options_t* options);
+
+// Opens the block created with [multi_producer] at [BLOCK_DIR]-[direction] to write
+// frames to it alongside its creator and other producers. A block_t has at most one frame
+// in progress, so every producer thread opens its own. The block stays owned by its
+// creator, producers close it with [close_block]. Returns NULL for single producer blocks.
+//
+// A producer that dies between [begin_write_frame] and its commit holds back the frames
+// of every other producer, until the block is destroyed.
+//
+//  usage:
+//      block_t* left = open_block_producer("stereo");
+//      write_frame(left, 640, 480, 3, now(), image);
+block_t* open_block_producer(const char* direction);
+
+// Returns the options used by [create_block]: [BUFFER_COUNT] slots synchronized
+// with SYNC_RWLOCK, backed by regular pages without any placement policy.
+block_options_t default_block_options();
 
 // Allocates a new [block_t] struct with name [direction] that points to an already exsting
-// mmap backed buffer_t located at [BLOCK_DIR]-[direciton]. This function is non-blocking.
+// mmap backed buffer_t located at [BLOCK_DIR]-[direciton]. The dimensions and the number
+// of images are read back from the buffer. This function is non-blocking.
 //
 // Preconditions:
 //  - [direction] cannot have a "/" character. If violated, an error message is
@@ -102,9 +436,64 @@ block_t* create_block(const char* direction, size_t width, size_t height, size_t
 //      close_block(forward):
 block_t* open_block(const char* direction);
 
-// Returns the size in bytes required to hold a singular image in block_t [b]
+// Same as [open_block], but every read from the returned block receives derived level
+// [level] of the frames (see [block_options_t]) instead of the frames themselves. Level 0
+// is the frame itself, level i the i-th entry of [derived] the block was created with.
+// Returns NULL if the block has no such level.
+//
+//  usage:
+//      block_t* forward_half = open_block_level("forward", 1);
+block_t* open_block_level(const char* direction, size_t level);
+
+// Same as [open_block_level], but if the block does not exist yet, waits up to
+// [timeout_ms] milliseconds (forever if negative) for a writer to create it. The wait
+// sleeps on inotify events of [BLOCK_DIR], so the block is opened as soon as it is
+// created. Returns NULL if the block did not appear in time.
+//
+//  usage:
+//      block_t* forward = wait_for_block("forward", 0, -1);
+block_t* wait_for_block(const char* direction, size_t level, int timeout_ms);
+
+// Returns the number of derived levels of block_t [b]
+size_t block_level_count(const block_t* b);
+
+// Returns the size in bytes required to hold a singular image in block_t [b], or in the
+// level it was opened at
 size_t block_image_size(const block_t* b);
 
+// Returns the layout of the images held in block_t [b], or in the level it was opened at
+image_format_t block_image_format(const block_t* b);
+
+// Returns the number of images held in block_t [b]
+size_t block_slot_count(const block_t* b);
+
+// Returns the number of bytes a slot of block_t [b] can hold: [block_image_size], or the
+// [max_payload_size] it was created with. This is the largest frame a read can return
+size_t block_payload_capacity(const block_t* b);
+
+// Returns the TIMESTAMP_* unit of the acquisition times of block_t [b]
+int block_timestamp_unit(const block_t* b);
+
+// Returns [acquisition_time], a time of a frame of block_t [b], in nanoseconds
+uint64_t frame_time_ns(const block_t* b, uint64_t acquisition_time);
+
+// Returns the start of the memory mapping of block_t [b] and sets [size] to its length,
+// e.g. to register the shared buffer with a DMA engine. The mapping is valid until the
+// block is closed.
+void* block_memory(const block_t* b, size_t* size);
+
+// Takes a snapshot of the counters of [block] and all of its readers into [stats]. Any
+// process may call this, e.g. a monitor that opened the block without ever reading from
+// it. The counters are read one by one while the block is in use, so they are not
+// consistent with each other to the frame.
+//
+//  usage:
+//      block_stats_t stats;
+//      block_stats(forward, &stats);
+//      for (size_t i = 0; i < stats.reader_count; i++)
+//          printf("%d skipped %lu\n", stats.readers[i].pid, stats.readers[i].frames_skipped);
+void block_stats(const block_t* block, block_stats_t* stats);
+
 // Returns true if the block whose buffer is backed at [BLOCK_DIR]-[direction]
 // is poisoned.
 //
@@ -113,6 +502,23 @@ size_t block_image_size(const block_t* b);
 bool cstr_block_is_poisoned(const char* direction);
 bool block_is_poisoned(const block_t* block);
 
+// Makes the current process the owner of the poisoned block backed at
+// [BLOCK_DIR]-[direction], in place. The buffer keeps its layout, its frames and its
+// readers, which stay attached and simply receive the frames of the new writer once it
+// writes with the same dimensions. A slot the crashed writer left locked is taken over,
+// so readers waiting for it resume with the next frame. Returns NULL if the block does
+// not exist or its owner is alive, e.g. if another writer reclaimed it first.
+//
+//  usage:
+//      block_t* forward = create_block("forward", 640, 480, 3, BUFFER_COUNT);
+//      if (forward == NULL && cstr_block_is_poisoned("forward"))
+//          forward = reclaim_block("forward");
+block_t* reclaim_block(const char* direction);
+
+// Returns the number of times [block] was reclaimed, which readers may compare to notice
+// that the writer restarted.
+uint32_t block_generation(const block_t* block);
+
 // Returns true if the block whose buffer is backed at [BLOCK_DIR]-[direction]
 // has an active writer
 //
@@ -122,17 +528,61 @@ bool cstr_block_is_alive(const char* direction);
 bool block_is_alive(const block_t* block);
 
 // Attempts to free memory associated withc[block] and destroy the buffer that
-// is pointed to by [block]. This function is blocking and will terminate when
-//      1) all read processes are stopped
-//      2) when all the data associated with [block] and the underlying [buffer]
-//          have been safely unallocated.
+// is pointed to by [block]. Readers wake up with BLOCK_NOT_ACTIVE and the buffer is
+// removed right away, without waiting for them: the kernel keeps its memory alive
+// until the last reader closes its block.
 // If the current process is not the owner of the [block], and the block is poisoned,
 // then this function acts as if the current process is the owner. If the current
 // process is not the owner of the [block], and the block is NOT poisoned, then
 // this function will do nothing.
 void destroy_block(block_t* block);
 
-// Frees memory associated with [block]. DOES NOT FREE UNDERLYING BUFFER.
+// The most blocks the registry holds, and the longest direction it holds. Blocks beyond
+// either limit work as usual, they are just not listed by [list_blocks].
+#define MAX_LISTED_BLOCKS 256
+#define MAX_DIRECTION_LENGTH 63
+
+// A block listed in the registry, see [list_blocks].
+//  - fps: frames written per second, as measured by the writer about once a second
+//  - alive: false once the owner died, until the block is reclaimed or destroyed
+typedef struct block_info {
+    char direction[MAX_DIRECTION_LENGTH + 1];
+    size_t width, height, depth;
+    int pixel_format;
+    size_t level_count;
+    size_t slot_count;
+    int sync_mode;
+    size_t payload_capacity;
+    double fps;
+    pid_t owner;
+    uint32_t generation;
+    bool alive;
+} block_info_t;
+
+// Copies the registry entries of up to [n] blocks into [blocks] and returns how many it
+// copied. Every block is added to the registry at [REGISTRY_ADDRESS] by the process that
+// creates or reclaims it, and removed when it is destroyed, so the blocks of a machine
+// are listed without opening a single one of them.
+//
+//  usage:
+//      block_info_t blocks[MAX_LISTED_BLOCKS];
+//      size_t count = list_blocks(blocks, MAX_LISTED_BLOCKS);
+size_t list_blocks(block_info_t* blocks, size_t n);
+
+// Waits up to [timeout_ms] milliseconds (forever if negative) for a block to be added to
+// or removed from the registry. [version] is the version of the registry the caller last
+// saw, 0 at first, and is updated to the current one. Returns false if the registry did
+// not change in time.
+//
+//  usage:
+//      uint32_t version = 0;
+//      do {
+//          size_t count = list_blocks(blocks, MAX_LISTED_BLOCKS);
+//          <...omitted...>
+//      } while (watch_blocks(&version, -1));
+bool watch_blocks(uint32_t* version, int timeout_ms);
+
+// Frees memory associated with [block] and unmaps its buffer. DOES NOT FREE UNDERLYING BUFFER.
 // Requires that [block] does not own the buffer (destroy block should be used
 // instead).
 //
@@ -153,28 +603,359 @@ void close_block(block_t* block);
 //      image buffer dimension
 //  - BLOCK_NOT_ACTIVE: there is no owner of the block and thus the data is stale
 //  - NO_NEW_FRAME: there are no new frames in the buffer
+//  - NO_FRAME_IN_PROGRESS: a frame was committed without calling [begin_write_frame]
+//  - FRAME_OVERWRITTEN: the writer reused the slot of a view while it was held
+//  - FRAME_DROPPED: the frame was not written because a reliable reader is behind
+//      (BACKPRESSURE_SKIP)
+//  - NO_READER_SLOT: all [MAX_READERS] reader slots of the block are taken
+//  - CONVERSION_NOT_SUPPORTED: the images of the block cannot be converted or downscaled
+//      as requested, see [read_frame_converted]
+//  - INVALID_REGION: the region to read is empty or not inside the images of the block,
+//      see [read_frame_roi]
+//  - RECORDING_FAILED: a recording could not be written to disk
+//  - DEVICE_COPY_FAILED: CUDA refused to copy a frame to the GPU
 #define SUCCESS 0
 #define FRAME_SIZE_MISMATCH 1
 #define BLOCK_NOT_ACTIVE 2
 #define NO_NEW_FRAME 3
+#define NO_FRAME_IN_PROGRESS 4
+#define FRAME_OVERWRITTEN 5
+#define FRAME_DROPPED 6
+#define NO_READER_SLOT 7
+#define CONVERSION_NOT_SUPPORTED 8
+#define INVALID_REGION 9
+#define RECORDING_FAILED 10
+#define DEVICE_COPY_FAILED 11
 
-// Writes the image data in [frame] to [buffer]
+// Writes the image data in [frame] to [buffer]. [data] holds [block_image_size] bytes laid
+// out as described by [block_image_format]. The derived levels of the block, if any, are
+// computed from it before the frame is published. [acquisition_time] is given in the
+// [timestamp_unit] of the block.
 int write_frame(block_t* block, size_t width, size_t height,
                 size_t depth, uint64_t acquisition_time, image* data);
 
+// Writes the [size] bytes at [data], encoded with [codec], to [block] as a single frame.
+// Returns FRAME_SIZE_MISMATCH if they do not fit into a slot (see
+// [block_payload_capacity]). Readers receive exactly [size] bytes.
+//
+//  usage:
+//      block_options_t options = default_block_options();
+//      options.max_payload_size = 1 << 20;
+//      block_t* forward = create_block_ex("forward-jpeg", 1920, 1080, 3, &options);
+//      write_packet(forward, jpeg, jpeg_size, CODEC_JPEG, now());
+int write_packet(block_t* block, const void* data, size_t size, uint32_t codec,
+                 uint64_t acquisition_time);
+
+// Zero-copy variant of [write_frame]. Write-locks the next slot in [block] and returns
+// a pointer to its image so the caller can fill it in place. The frame is published to
+// readers, with [acquisition_time], by [commit_write_frame]. Returns NULL if the block
+// is not active, if another frame is already in progress or if the frame is dropped
+// because of BACKPRESSURE_SKIP.
+//
+//  usage:
+//      image* slot = begin_write_frame(forward);
+//      decode_into(slot, block_image_size(forward));
+//      commit_write_frame(forward, now());
+image* begin_write_frame(block_t* block);
+int commit_write_frame(block_t* block, uint64_t acquisition_time);
+
+// Same as [commit_write_frame], but publishes the first [size] bytes of the slot returned
+// by [begin_write_frame], encoded with [codec], so that e.g. an encoder can write
+// straight into the slot. Returns FRAME_SIZE_MISMATCH, and keeps the frame in progress, if [size]
+// exceeds [block_payload_capacity], or if the block has derived levels, which can only be
+// computed from raw images.
+int commit_write_packet(block_t* block, size_t size, uint32_t codec,
+                        uint64_t acquisition_time);
+
 // Reads the earliest frame in [buffer] that is newer than the image held in [frame].
 // [read_frame] will wait for a new frame if [block_thread] is true. Else,
 // it terminates with exit code [NO_NEW_FRAME], and [frame] is unchanged.
+// [frame] is only (re)allocated if it cannot hold [block_payload_capacity] bytes. If it
+// uses caller-supplied storage that is too small, FRAME_SIZE_MISMATCH is returned instead.
+// Only the frame's [payload_size] bytes are copied.
+// In SYNC_SEQLOCK mode a frame that is overwritten while it is copied is skipped in
+// favor of a newer one.
 int read_frame(block_t* block, frame_t* frame, bool block_thread);
 
+// Same as [read_frame], but the image is converted and downscaled (see [convert_image])
+// while it is copied out of the buffer, so that consumers of smaller or converted images
+// do not need another pass over the frame. [frame] receives the converted image and its
+// dimensions and [format], and is only (re)allocated if it cannot hold it. Returns
+// CONVERSION_NOT_SUPPORTED for blocks whose images cannot be converted that way, and for
+// blocks of variable-length payloads, see [converted_image_format].
+//
+//  usage:
+//      frame_t* small = create_frame();
+//      while (read_frame_converted(forward, small, CONVERT_BGR_TO_RGB, 2, true) == SUCCESS)
+//          detect(small->data, small->width, small->height);
+int read_frame_converted(block_t* block, frame_t* frame, int conversion, size_t scale,
+                         bool block_thread);
+
+// Same as [read_frame], but only the [width] * [height] pixels at [x], [y] (the top left
+// corner) are copied out of the buffer, e.g. the area around a tracked object. [frame]
+// receives them as a packed image of those dimensions, which is all it needs to hold.
+// Returns INVALID_REGION if the region is empty or does not lie inside the images of
+// [block], and for blocks of multi-plane images (NV12, I420) or variable-length
+// payloads.
+//
+//  usage:
+//      frame_t* crop = create_frame();
+//      read_frame_roi(forward, crop, box.x - 100, box.y - 100, 200, 200, true);
+int read_frame_roi(block_t* block, frame_t* frame, size_t x, size_t y, size_t width,
+                   size_t height, bool block_thread);
+
+// Zero-copy variant of [read_frame]. Points [view] at the earliest frame in [buffer]
+// that is newer than the frame previously held in [view] and keeps that slot read-locked
+// until [release_frame_view] is called. A view that is still held is released first.
+// In SYNC_RWLOCK mode the writer cannot overwrite the slot while the view is held, so
+// views should be released as soon as the caller is done looking at them. In
+// SYNC_SEQLOCK mode the view is only a lease: the writer may reuse the slot at any time,
+// which [release_frame_view] reports.
+int acquire_frame_view(block_t* block, frame_view_t* view, bool block_thread);
+
+// Zero-copy variant of [read_frame_roi]. Points [view] at the [width] * [height] pixels at
+// [x], [y] of the frame [acquire_frame_view] would acquire. The rows of the view are as
+// far apart as they are in the buffer, see [view]'s [format].
+int acquire_frame_view_roi(block_t* block, frame_view_t* view, size_t x, size_t y,
+                           size_t width, size_t height, bool block_thread);
+
+// Releases the slot held by [view]. [view] keeps its frame_uid so the next
+// [acquire_frame_view] continues from it. Releasing an unheld view does nothing.
+// Returns FRAME_OVERWRITTEN if the data seen through [view] may have been modified
+// by the writer (SYNC_SEQLOCK only), else SUCCESS.
+int release_frame_view(block_t* block, frame_view_t* view);
+
+// Batch variant of [read_frame] for consumers that need a window of consecutive frames.
+// Once [block] holds a frame that is newer than every frame in [frames], the up to [n]
+// consecutive frames that end with the newest one are read into [frames], oldest first,
+// in a single pass during which the writer cannot interleave. [frames_read] is set to
+// the number of frames read, which is less than [n] if the buffer does not hold that many
+// (it can hold at most [block_slot_count] frames, one less in SYNC_SEQLOCK mode).
+//
+//  usage:
+//      frame_t window[8] = {0};
+//      size_t count;
+//      while (read_frames(forward, window, 8, &count, true) == SUCCESS)
+//          classify(window, count);
+int read_frames(block_t* block, frame_t* frames, size_t n, size_t* frames_read,
+                bool block_thread);
+
+// Zero-copy variant of [read_frames]. Every acquired view must be released with
+// [release_frame_view]. Views that are still held are released first.
+int acquire_frame_views(block_t* block, frame_view_t* views, size_t n, size_t* views_acquired,
+                        bool block_thread);
+
+// Acquires one view per block of [blocks] at the same time, on the newest set of frames
+// whose acquisition times (see [frame_time_ns]) are at most [tolerance_ns] apart, e.g.
+// the matching images of a stereo pair. Every frame of the set is newer than the one
+// previously held in its view of [views], so a set is only returned once. Waits for
+// (if [block_thread]) such a set: a block that writes slower than the others, or whose
+// frames do not match yet, is waited on. Views are held and released like those of
+// [acquire_frame_view]; views that are still held are released first.
+//
+//  usage:
+//      block_t* cameras[] = {open_block("left"), open_block("right")};
+//      frame_view_t pair[2] = {0};
+//      while (read_synced(cameras, 2, 2000000, pair, true) == SUCCESS) {
+//          match_stereo(&pair[0], &pair[1]);
+//          release_frame_view(cameras[0], &pair[0]);
+//          release_frame_view(cameras[1], &pair[1]);
+//      }
+int read_synced(block_t** blocks, size_t n, uint64_t tolerance_ns, frame_view_t* views,
+                bool block_thread);
+
+// Returns a file descriptor that becomes readable whenever a frame is written to [block]
+// (or the block dies), so that a single thread can wait on many blocks with
+// poll/epoll/select or an event loop. The descriptor stays readable until a
+// non-blocking [read_frame] (or any other non-blocking read) reports NO_NEW_FRAME.
+// It is owned by [block] and closed by [close_block]. Returns -1 if [MAX_READERS]
+// readers already registered.
+//
+//  usage:
+//      struct pollfd fds[] = {{block_notify_fd(forward), POLLIN}, {block_notify_fd(down), POLLIN}};
+//      while (poll(fds, 2, -1) > 0) {
+//          while (read_frame(forward, forward_frame, false) == SUCCESS) <...omitted...>
+//          while (read_frame(down, down_frame, false) == SUCCESS) <...omitted...>
+//      }
+int block_notify_fd(block_t* block);
+
+// Registers the reader of [block] in the block's reader table, so that the writer takes
+// its position into account. [block]'s reader position (its cursor) is the newest frame it
+// read with any function above, or released for views. A [reliable] reader receives every
+// frame written after it registered, unless the block uses BACKPRESSURE_OVERWRITE.
+// Readers are best-effort by default; registering again changes the kind of reader.
+// Returns NO_READER_SLOT if [MAX_READERS] readers already registered.
+//
+//  usage:
+//      block_t* forward = open_block("forward");
+//      register_reader(forward, true);  // e.g. a recorder that must not miss a frame
+int register_reader(block_t* block, bool reliable);
+
+// How the blocking reads of a block_t wait for the next frame, see [set_wait_policy].
+//  - spin_ns: poll the block for up to this many nanoseconds before going to sleep. A
+//      reader that is still polling sees a frame as soon as it is published, instead of
+//      paying the tens of microseconds it takes to wake a sleeping thread, but keeps its
+//      core busy. This only pays off if the writer does not have to share that core.
+//      0 sleeps right away, which is the default
+//  - yield: give up the core with sched_yield between polls instead of spinning on it
+//  - cpu: pin the thread that sets the policy to this CPU, e.g. one set aside for the
+//      reader with isolcpus. -1 leaves its affinity alone
+typedef struct wait_policy {
+    uint64_t spin_ns;
+    bool yield;
+    int cpu;
+} wait_policy_t;
+
+// Makes the blocking reads of [block] (read_frame, acquire_frame_view, ...) wait as
+// described by [policy]. The policy belongs to the block_t, so every reader picks its own.
+// Returns false if the calling thread could not be pinned to the policy's CPU, the rest
+// of the policy applies anyway.
+//
+//  usage:
+//      block_t* control = open_block("control");
+//      wait_policy_t policy = {.spin_ns = 200000, .yield = false, .cpu = 3};
+//      set_wait_policy(control, &policy);
+//      while (read_frame(control, frame, true) == SUCCESS) <...omitted...>
+bool set_wait_policy(block_t* block, const wait_policy_t* policy);
+
 // Creates an empty frame struct in a way such that all images are newer than
-// than the image held in the struct and returns a pointer to it.
+// than the image held in the struct and returns a pointer to it. Its image data is
+// allocated by the first call to [read_frame].
 frame_t* create_frame();
 
+// Same as [create_frame], but the image data is allocated up front so that it can hold
+// any frame of [block], optionally aligned to a page boundary. Reading from [block]
+// never calls the allocator.
+frame_t* create_frame_for_block(const block_t* block, bool page_aligned);
+
+// Same as [create_frame], but images are read into the [capacity] bytes at [data],
+// e.g. a slice of a caller-managed pool. [data] is not freed by [delete_frame].
+frame_t* create_frame_with_storage(image* data, size_t capacity);
+
 // given [ptr] for frame_t, this function safely frees the memory
 // and deletes [ptr]
 void delete_frame(frame_t* ptr);
 
+/* ############################################################################
+ * The following section deals with recording the frames of a block to a file, and
+ * replaying them into a block later, e.g. to reproduce a bug or to benchmark a
+ * pipeline offline at faster than camera rate. See record.c for the file layout.
+ * ############################################################################
+ */
+
+// A frame held by a recording. [frame_uid] and [acquisition_time] are the ones it was
+// published with, [offset] is where its [payload_size] bytes start in the file.
+typedef struct recorded_frame {
+    uint64_t frame_uid;
+    uint64_t acquisition_time;
+    uint64_t offset;
+    uint64_t payload_size;
+    uint32_t codec;
+} recorded_frame_t;
+
+typedef struct recorder recorder_t;
+typedef struct recording recording_t;
+
+// Creates the recording [path] (replacing any file there) for the frames read from
+// [block], which must stay open until [close_recorder]. The recorder reads with
+// [acquire_frame_view], so it can be registered as a reliable reader with
+// [register_reader] to not miss a frame. Returns NULL on failure.
+//
+//  usage:
+//      block_t* forward = open_block("forward");
+//      recorder_t* recorder = create_recorder("forward.fbr", forward);
+//      while (running) record_frame(recorder, true);
+//      close_recorder(recorder);
+recorder_t* create_recorder(const char* path, block_t* block);
+
+// Appends the next frame of the recorder's block to the recording. Waits for it if
+// [block_thread] is true, like [acquire_frame_view]. Frames are written to disk in the
+// background, in large batches. Returns the exit code of the read (a frame that is
+// overwritten while it is recorded, FRAME_OVERWRITTEN, is left out), or RECORDING_FAILED
+// once writing to disk failed.
+int record_frame(recorder_t* recorder, bool block_thread);
+
+// Returns the number of frames recorded so far
+size_t recorder_frame_count(const recorder_t* recorder);
+
+// Writes the remaining frames and the index of the recording to disk and frees
+// [recorder]. Returns RECORDING_FAILED if the recording is incomplete, else SUCCESS.
+int close_recorder(recorder_t* recorder);
+
+// Maps the recording at [path]. A recording whose recorder did not close it (e.g.
+// because it crashed) can be opened as well, it holds the frames that made it to disk.
+// Returns NULL if [path] is not a recording.
+recording_t* open_recording(const char* path);
+
+// Returns the number of frames in [recording]
+size_t recording_frame_count(const recording_t* recording);
+
+// Returns frame [index] of [recording], or NULL if there is no such frame. Its payload
+// is [recording_frame_data], which stays valid until [close_recording].
+const recorded_frame_t* recording_frame(const recording_t* recording, size_t index);
+const image* recording_frame_data(const recording_t* recording, size_t index);
+
+// Returns the layout of the images in [recording]
+image_format_t recording_image_format(const recording_t* recording);
+
+// Same as [create_block_ex], but the block gets the geometry, pixel format, row
+// alignment, payload capacity and timestamp unit of the block [recording] was recorded
+// from. Every other option is taken from [options].
+block_t* create_replay_block(const char* direction, const recording_t* recording,
+                             const block_options_t* options);
+
+// Publishes frame [index] of [recording] to [block] with its original acquisition time.
+// The frame is copied from the mapped file straight into the slot. Returns NO_NEW_FRAME
+// if there is no such frame, else the exit code of [write_packet]. Pacing the frames is
+// up to the caller.
+//
+//  usage:
+//      recording_t* recording = open_recording("forward.fbr");
+//      block_t* forward = create_replay_block("forward", recording, &options);
+//      for (size_t i = 0; replay_frame(forward, recording, i) != NO_NEW_FRAME; i++)
+//          wait_until(recording_frame(recording, i + 1));
+int replay_frame(block_t* block, const recording_t* recording, size_t index);
+
+// Unmaps [recording] and frees it
+void close_recording(recording_t* recording);
+
+/* ############################################################################
+ * The following section lets CUDA readers copy frames to the GPU straight out of the
+ * shared buffer. It is only built when BUILD_CUDA is set in configure.py, and declared
+ * when FRAMEBUFFER_CUDA is defined.
+ * ############################################################################
+ */
+
+#ifdef FRAMEBUFFER_CUDA
+#include <cuda_runtime_api.h>
+
+// Page-locks the mapping of [block] for CUDA in the calling process, so that frames are
+// copied to the GPU by DMA instead of through a staging buffer of the driver. Every
+// process that reads frames to the GPU registers the block once, after opening it, and
+// unregisters it with [unregister_block_cuda] before closing it. Returns false on failure.
+bool register_block_cuda(block_t* block);
+
+// Undoes [register_block_cuda]
+void unregister_block_cuda(block_t* block);
+
+// Acquires the next frame like [acquire_frame_view] and enqueues an asynchronous copy of
+// its payload into the [capacity] bytes at [device] on [stream]. [view] keeps the slot
+// leased, so it must only be released with [release_frame_view] once [stream] has
+// finished the copy; in SYNC_SEQLOCK mode the release tells whether the copy is torn.
+// Returns FRAME_SIZE_MISMATCH if the payload is larger than [capacity], and
+// DEVICE_COPY_FAILED if the copy could not be enqueued. [view] is released in either case.
+//
+//  usage:
+//      register_block_cuda(forward);
+//      while (read_frame_to_device(forward, &view, input, input_size, stream, true) == SUCCESS) {
+//          cudaStreamSynchronize(stream);
+//          release_frame_view(forward, &view);
+//          infer(input, stream);
+//      }
+int read_frame_to_device(block_t* block, frame_view_t* view, void* device, size_t capacity,
+                         cudaStream_t stream, bool block_thread);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,193 @@
+// Look at buffer.h for in depth documentation
+// Colour conversion and box downscaling of images, fused with the copy out of a slot
+//
+// The kernels are plain loops over rows that the compiler vectorizes (this file is built
+// with -O3). On x86-64 every kernel is additionally cloned for AVX2 and AVX-512
+// (x86-64-v4) and picked at load time, aarch64 always has NEON. Downscaled rows are
+// produced in chunks that fit into L1: the source rows of a chunk are summed vertically,
+// then horizontally, then converted, so each source byte is read from memory exactly
+// once.
+#include "buffer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define VECTORIZED __attribute__((target_clones("arch=x86-64-v4", "avx2", "default")))
+#else
+#define VECTORIZED
+#endif
+
+// fixed-point BT.601 luma weights, the same ones cv2.cvtColor uses for 8 bit images
+#define GRAY_SHIFT 14
+#define GRAY_B 1868
+#define GRAY_G 9617
+#define GRAY_R 4899
+
+// number of source bytes of a row that are summed at a time when downscaling
+#define SUM_CHUNK 3072
+
+VECTORIZED void swap_red_blue_row(const image* restrict source, image* restrict destination,
+                                  size_t width) {
+    for (size_t x = 0; x < width; x++) {
+        destination[3 * x] = source[3 * x + 2];
+        destination[3 * x + 1] = source[3 * x + 1];
+        destination[3 * x + 2] = source[3 * x];
+    }
+}
+
+VECTORIZED void gray_row(const image* restrict source, image* restrict destination,
+                         size_t width) {
+    for (size_t x = 0; x < width; x++) {
+        uint32_t luma = source[3 * x] * GRAY_B + source[3 * x + 1] * GRAY_G +
+                        source[3 * x + 2] * GRAY_R;
+        destination[x] = (luma + (1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT;
+    }
+}
+
+// sums[i] = the sum of byte i of [rows] rows that are [stride] bytes apart
+VECTORIZED void sum_rows(const image* restrict source, size_t stride, size_t rows,
+                         uint16_t* restrict sums, size_t n) {
+    for (size_t i = 0; i < n; i++) sums[i] = source[i];
+    for (size_t row = 1; row < rows; row++) {
+        const image* restrict line = source + row * stride;
+        for (size_t i = 0; i < n; i++) sums[i] += line[i];
+    }
+}
+
+// averages [scale] consecutive pixels of [sums] (the sums of [scale] rows) into each of
+// the [width] pixels of [destination], rounding to nearest
+VECTORIZED void average_columns(const uint16_t* restrict sums, image* restrict destination,
+                                size_t width, size_t channels, size_t scale) {
+    size_t shift = scale == 4 ? 4 : 2;
+    uint32_t half = 1u << (shift - 1);
+    if (channels == 3 && scale == 2) {
+        for (size_t x = 0; x < width; x++) {
+            const uint16_t* s = sums + 6 * x;
+            destination[3 * x] = (s[0] + s[3] + half) >> shift;
+            destination[3 * x + 1] = (s[1] + s[4] + half) >> shift;
+            destination[3 * x + 2] = (s[2] + s[5] + half) >> shift;
+        }
+        return;
+    }
+    if (channels == 1 && scale == 2) {
+        for (size_t x = 0; x < width; x++)
+            destination[x] = (sums[2 * x] + sums[2 * x + 1] + half) >> shift;
+        return;
+    }
+    if (channels == 3 && scale == 4) {
+        for (size_t x = 0; x < width; x++) {
+            const uint16_t* s = sums + 12 * x;
+            destination[3 * x] = (s[0] + s[3] + s[6] + s[9] + half) >> shift;
+            destination[3 * x + 1] = (s[1] + s[4] + s[7] + s[10] + half) >> shift;
+            destination[3 * x + 2] = (s[2] + s[5] + s[8] + s[11] + half) >> shift;
+        }
+        return;
+    }
+    if (channels == 1 && scale == 4) {
+        for (size_t x = 0; x < width; x++) {
+            const uint16_t* s = sums + 4 * x;
+            destination[x] = (s[0] + s[1] + s[2] + s[3] + half) >> shift;
+        }
+        return;
+    }
+    for (size_t x = 0; x < width; x++) {
+        for (size_t c = 0; c < channels; c++) {
+            uint32_t sum = 0;
+            for (size_t i = 0; i < scale; i++) sum += sums[(x * scale + i) * channels + c];
+            destination[x * channels + c] = (sum + half) >> shift;
+        }
+    }
+}
+
+bool converted_image_format(const image_format_t* format, int conversion, size_t scale,
+                            image_format_t* converted) {
+    if (format->pixel_format != PIXEL_FORMAT_U8) {
+        fprintf(stderr, "Only images of PIXEL_FORMAT_U8 can be converted.");
+        return false;
+    }
+    if (scale != 1 && scale != 2 && scale != 4) {
+        fprintf(stderr, "Images can only be downscaled by 1, 2 or 4, not %zu.", scale);
+        return false;
+    }
+    const plane_t* plane = &format->planes[0];
+    if (plane->channels * scale > SUM_CHUNK) {
+        fprintf(stderr, "Images with %zu channels cannot be converted.", plane->channels);
+        return false;
+    }
+    size_t depth;
+    switch (conversion) {
+        case CONVERT_COPY:
+            depth = plane->channels;
+            break;
+        case CONVERT_BGR_TO_RGB:
+        case CONVERT_BGR_TO_GRAY:
+            if (plane->channels != 3) {
+                fprintf(stderr, "Conversion %d expects 3 channels, not %zu.", conversion,
+                        plane->channels);
+                return false;
+            }
+            depth = conversion == CONVERT_BGR_TO_RGB ? 3 : 1;
+            break;
+        default:
+            fprintf(stderr, "Unknown conversion %d.", conversion);
+            return false;
+    }
+    return image_format_init(converted, PIXEL_FORMAT_U8, plane->width / scale,
+                             plane->height / scale, depth, 0);
+}
+
+// converts the [width] pixels of [source], which have [channels] channels, into
+// [destination]
+void convert_row(const image* source, image* destination, size_t width, size_t channels,
+                 int conversion) {
+    switch (conversion) {
+        case CONVERT_BGR_TO_RGB:
+            swap_red_blue_row(source, destination, width);
+            break;
+        case CONVERT_BGR_TO_GRAY:
+            gray_row(source, destination, width);
+            break;
+        default:
+            memcpy(destination, source, width * channels);
+            break;
+    }
+}
+
+void convert_image(const image* source, const image_format_t* format, image* destination,
+                   int conversion, size_t scale) {
+    image_format_t converted;
+    if (!converted_image_format(format, conversion, scale, &converted)) return;
+
+    const plane_t* plane = &format->planes[0];
+    const plane_t* output = &converted.planes[0];
+    size_t channels = plane->channels;
+    source += plane->offset;
+
+    if (scale == 1) {
+        for (size_t y = 0; y < output->height; y++)
+            convert_row(source + y * plane->stride, destination + y * output->stride,
+                        output->width, channels, conversion);
+        return;
+    }
+
+    // pixels of the output that are produced per chunk
+    size_t chunk_width = SUM_CHUNK / (scale * channels);
+    uint16_t sums[SUM_CHUNK];
+    image averages[SUM_CHUNK];
+    for (size_t y = 0; y < output->height; y++) {
+        const image* rows = source + y * scale * plane->stride;
+        image* row = destination + y * output->stride;
+        for (size_t x = 0; x < output->width; x += chunk_width) {
+            size_t width = output->width - x < chunk_width ? output->width - x : chunk_width;
+            sum_rows(rows + x * scale * channels, plane->stride, scale, sums,
+                     width * scale * channels);
+            if (conversion == CONVERT_COPY) {
+                average_columns(sums, row + x * channels, width, channels, scale);
+                continue;
+            }
+            average_columns(sums, averages, width, channels, scale);
+            convert_row(averages, row + x * output->channels, width, channels, conversion);
+        }
+    }
+}
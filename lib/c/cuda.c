@@ -0,0 +1,40 @@
+// Copies frames from the shared buffer to the GPU. Built only with BUILD_CUDA.
+#include "buffer.h"
+
+#include <stdio.h>
+
+bool register_block_cuda(block_t* block) {
+    size_t size;
+    void* memory = block_memory(block, &size);
+    cudaError_t error = cudaHostRegister(memory, size, cudaHostRegisterDefault);
+    if (error != cudaSuccess) {
+        fprintf(stderr, "Failed to register the block with CUDA: %s.", cudaGetErrorString(error));
+        return false;
+    }
+    return true;
+}
+
+void unregister_block_cuda(block_t* block) {
+    size_t size;
+    cudaHostUnregister(block_memory(block, &size));
+}
+
+int read_frame_to_device(block_t* block, frame_view_t* view, void* device, size_t capacity,
+                         cudaStream_t stream, bool block_thread) {
+    int exit_code = acquire_frame_view(block, view, block_thread);
+    if (exit_code != SUCCESS) return exit_code;
+    if (view->payload_size > capacity) {
+        release_frame_view(block, view);
+        return FRAME_SIZE_MISMATCH;
+    }
+
+    // the copy reads the slot while [view] holds it, with a DMA if the block is registered
+    cudaError_t error = cudaMemcpyAsync(device, view->data, view->payload_size,
+                                        cudaMemcpyHostToDevice, stream);
+    if (error != cudaSuccess) {
+        fprintf(stderr, "Failed to copy a frame to the GPU: %s.", cudaGetErrorString(error));
+        release_frame_view(block, view);
+        return DEVICE_COPY_FAILED;
+    }
+    return SUCCESS;
+}
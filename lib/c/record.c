@@ -0,0 +1,425 @@
+// Look at buffer.h for in depth documentation
+// Recording the frames of a block to a file, and replaying them into a block
+//
+// A recording starts with a [RECORDING_ALIGNMENT] byte header that describes the block,
+// followed by one record per frame and an index of all records at the end. Each record
+// is a [RECORD_HEADER_SIZE] byte header followed by the frame's payload, on a
+// [RECORD_ALIGNMENT] byte boundary. The index is written when the recorder is closed. A
+// recording whose recorder died has no index, which is rebuilt from the record headers
+// when it is opened.
+//
+// Records are collected in two page-aligned chunks. While one of them is filled, the
+// other one is written to disk with O_DIRECT by a background thread, so recording never
+// waits for the disk unless it falls behind, and the recorded frames do not pollute the
+// page cache. O_DIRECT requires every write to start and end on a page boundary, which is
+// why chunks are padded to [RECORDING_ALIGNMENT] bytes.
+#define _GNU_SOURCE
+#include "buffer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RECORDING_MAGIC 0x44524f4345524246ull  // "FBRECORD" in memory
+#define RECORDING_VERSION 2u
+#define RECORD_MAGIC 0x44524352u  // "RCRD" in memory
+
+#define RECORDING_ALIGNMENT 4096
+#define RECORD_ALIGNMENT 64
+#define RECORD_HEADER_SIZE 64
+// chunks are at least this large, and large enough to hold the largest record
+#define CHUNK_SIZE (4ul << 20)
+
+#define round_up(n, alignment) (((n) + (alignment) - 1) / (alignment) * (alignment))
+
+// the first [RECORDING_ALIGNMENT] bytes of a recording
+typedef struct recording_header {
+    uint64_t magic;     // [RECORDING_MAGIC]
+    uint32_t version;   // [RECORDING_VERSION]
+    size_t width, height, depth;
+    size_t payload_capacity;  // [block_payload_capacity] of the recorded block
+    image_format_t format;
+    int timestamp_unit;  // [block_timestamp_unit] of the recorded block
+    uint64_t frame_count;
+    uint64_t index_offset;  // 0 until the recorder is closed
+} recording_header_t;
+
+typedef struct record_header {
+    uint32_t magic;  // [RECORD_MAGIC]
+    recorded_frame_t frame;
+} record_header_t;
+
+struct recorder {
+    int fd;
+    block_t* block;
+    frame_view_t view;
+    recording_header_t* header;  // page-aligned, so that it can be written with O_DIRECT
+    recorded_frame_t* index;
+    size_t index_capacity;
+
+    image* chunks[2];
+    size_t chunk_size;
+    int current;            // index of the chunk that is being filled
+    size_t fill;            // bytes of the current chunk in use
+    uint64_t chunk_offset;  // where the current chunk goes in the file
+
+    // the chunk handed to [write_chunks], NULL once it is written
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    image* pending;
+    size_t pending_size;
+    uint64_t pending_offset;
+    bool stopping;
+    _Atomic bool failed;
+};
+
+struct recording {
+    const image* data;
+    size_t size;
+    const recording_header_t* header;
+    const recorded_frame_t* index;
+    size_t frame_count;
+    recorded_frame_t* rebuilt_index;  // owned if the index was rebuilt, else NULL
+};
+
+// Writes all [size] bytes at [data] to [fd] at [offset]. Returns false on failure.
+bool write_all(int fd, const image* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, offset);
+        if (written == -1 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+// The background thread of a recorder, which writes every chunk handed to it.
+void* write_chunks(void* argument) {
+    recorder_t* recorder = (recorder_t*)argument;
+    pthread_mutex_lock(&recorder->mutex);
+    while (true) {
+        while (recorder->pending == NULL && !recorder->stopping)
+            pthread_cond_wait(&recorder->changed, &recorder->mutex);
+        if (recorder->pending == NULL) break;
+
+        image* chunk = recorder->pending;
+        size_t size = recorder->pending_size;
+        uint64_t offset = recorder->pending_offset;
+        pthread_mutex_unlock(&recorder->mutex);
+        bool written = write_all(recorder->fd, chunk, size, offset);
+        pthread_mutex_lock(&recorder->mutex);
+
+        if (!written) {
+            fprintf(stderr, "Failed to write to the recording: %s.", strerror(errno));
+            atomic_store(&recorder->failed, true);
+        }
+        recorder->pending = NULL;
+        pthread_cond_broadcast(&recorder->changed);
+    }
+    pthread_mutex_unlock(&recorder->mutex);
+    return NULL;
+}
+
+// Waits until the chunk handed to the background thread is written.
+void wait_for_chunk(recorder_t* recorder) {
+    pthread_mutex_lock(&recorder->mutex);
+    while (recorder->pending != NULL) pthread_cond_wait(&recorder->changed, &recorder->mutex);
+    pthread_mutex_unlock(&recorder->mutex);
+}
+
+// Hands the current chunk to the background thread and continues with the other one.
+void submit_chunk(recorder_t* recorder) {
+    if (recorder->fill == 0) return;
+    image* chunk = recorder->chunks[recorder->current];
+    size_t size = round_up(recorder->fill, RECORDING_ALIGNMENT);
+    memset(chunk + recorder->fill, 0, size - recorder->fill);
+
+    wait_for_chunk(recorder);
+    pthread_mutex_lock(&recorder->mutex);
+    recorder->pending = chunk;
+    recorder->pending_size = size;
+    recorder->pending_offset = recorder->chunk_offset;
+    pthread_cond_broadcast(&recorder->changed);
+    pthread_mutex_unlock(&recorder->mutex);
+
+    recorder->chunk_offset += size;
+    recorder->current ^= 1;
+    recorder->fill = 0;
+}
+
+// Opens [path] for writing, with O_DIRECT unless its file system does not support it
+// (e.g. tmpfs).
+int open_recording_file(const char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT | O_CLOEXEC, 0644);
+    if (fd == -1 && errno == EINVAL) fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) fprintf(stderr, "Failed to create recording \"%s\": %s.", path, strerror(errno));
+    return fd;
+}
+
+void free_recorder(recorder_t* recorder) {
+    if (recorder->fd != -1) close(recorder->fd);
+    free(recorder->header);
+    free(recorder->index);
+    free(recorder->chunks[0]);
+    free(recorder->chunks[1]);
+    free(recorder);
+}
+
+recorder_t* create_recorder(const char* path, block_t* block) {
+    recorder_t* recorder = (recorder_t*)calloc(1, sizeof(recorder_t));
+    recorder->block = block;
+    recorder->fd = open_recording_file(path);
+    if (recorder->fd == -1) {
+        free_recorder(recorder);
+        return NULL;
+    }
+
+    recorder->chunk_size = round_up(RECORD_HEADER_SIZE + block_payload_capacity(block),
+                                    RECORDING_ALIGNMENT);
+    if (recorder->chunk_size < CHUNK_SIZE) recorder->chunk_size = CHUNK_SIZE;
+    if (posix_memalign((void**)&recorder->header, RECORDING_ALIGNMENT, RECORDING_ALIGNMENT) ||
+        posix_memalign((void**)&recorder->chunks[0], RECORDING_ALIGNMENT, recorder->chunk_size) ||
+        posix_memalign((void**)&recorder->chunks[1], RECORDING_ALIGNMENT, recorder->chunk_size)) {
+        fprintf(stderr, "Failed to allocate the chunks of a recording.");
+        free_recorder(recorder);
+        return NULL;
+    }
+
+    // the header is written again with the index once the recorder is closed
+    recording_header_t* header = recorder->header;
+    memset(header, 0, RECORDING_ALIGNMENT);
+    header->magic = RECORDING_MAGIC;
+    header->version = RECORDING_VERSION;
+    header->format = block_image_format(block);
+    header->width = header->format.planes[0].width;
+    header->height = header->format.planes[0].height;
+    header->depth = header->format.planes[0].channels;
+    header->payload_capacity = block_payload_capacity(block);
+    header->timestamp_unit = block_timestamp_unit(block);
+    if (!write_all(recorder->fd, (image*)header, RECORDING_ALIGNMENT, 0)) {
+        fprintf(stderr, "Failed to write to recording \"%s\": %s.", path, strerror(errno));
+        free_recorder(recorder);
+        return NULL;
+    }
+    recorder->chunk_offset = RECORDING_ALIGNMENT;
+
+    pthread_mutex_init(&recorder->mutex, NULL);
+    pthread_cond_init(&recorder->changed, NULL);
+    if (pthread_create(&recorder->thread, NULL, write_chunks, recorder) != 0) {
+        fprintf(stderr, "Failed to start the writer thread of a recording.");
+        free_recorder(recorder);
+        return NULL;
+    }
+    return recorder;
+}
+
+int record_frame(recorder_t* recorder, bool block_thread) {
+    if (atomic_load(&recorder->failed)) return RECORDING_FAILED;
+    // handing off a chunk may wait for the disk, so it happens before the frame is acquired
+    // and keeps the writer from its slot. No record is larger than the payload capacity.
+    size_t max_record_size = round_up(RECORD_HEADER_SIZE + block_payload_capacity(recorder->block),
+                                      RECORD_ALIGNMENT);
+    if (recorder->fill + max_record_size > recorder->chunk_size) submit_chunk(recorder);
+
+    frame_view_t* view = &recorder->view;
+    int exit_code = acquire_frame_view(recorder->block, view, block_thread);
+    if (exit_code != SUCCESS) return exit_code;
+
+    size_t record_size = round_up(RECORD_HEADER_SIZE + view->payload_size, RECORD_ALIGNMENT);
+    image* record = recorder->chunks[recorder->current] + recorder->fill;
+    memcpy(record + RECORD_HEADER_SIZE, view->data, view->payload_size);
+    // a frame that was overwritten while it was copied is left out
+    exit_code = release_frame_view(recorder->block, view);
+    if (exit_code != SUCCESS) return exit_code;
+
+    size_t count = recorder->header->frame_count;
+    if (count == recorder->index_capacity) {
+        recorder->index_capacity = count ? 2 * count : 1024;
+        recorder->index = (recorded_frame_t*)realloc(
+            recorder->index, recorder->index_capacity * sizeof(recorded_frame_t));
+    }
+    recorded_frame_t* frame = &recorder->index[count];
+    *frame = (recorded_frame_t){
+        .frame_uid = view->frame_uid,
+        .acquisition_time = view->acquisition_time,
+        .offset = recorder->chunk_offset + recorder->fill + RECORD_HEADER_SIZE,
+        .payload_size = view->payload_size,
+        .codec = view->codec,
+    };
+    record_header_t header = {.magic = RECORD_MAGIC, .frame = *frame};
+    memset(record, 0, RECORD_HEADER_SIZE);
+    memcpy(record, &header, sizeof(header));
+    size_t used = RECORD_HEADER_SIZE + view->payload_size;
+    memset(record + used, 0, record_size - used);
+
+    recorder->fill += record_size;
+    recorder->header->frame_count = count + 1;
+    return SUCCESS;
+}
+
+size_t recorder_frame_count(const recorder_t* recorder) {
+    return recorder->header->frame_count;
+}
+
+int close_recorder(recorder_t* recorder) {
+    recording_header_t* header = recorder->header;
+    release_frame_view(recorder->block, &recorder->view);
+
+    // the index follows the last record, spread over as many chunks as it takes
+    const image* index = (const image*)recorder->index;
+    size_t remaining = header->frame_count * sizeof(recorded_frame_t);
+    header->index_offset = recorder->chunk_offset + recorder->fill;
+    while (remaining > 0) {
+        if (recorder->fill == recorder->chunk_size) submit_chunk(recorder);
+        size_t size = recorder->chunk_size - recorder->fill;
+        if (size > remaining) size = remaining;
+        memcpy(recorder->chunks[recorder->current] + recorder->fill, index, size);
+        recorder->fill += size;
+        index += size;
+        remaining -= size;
+    }
+    submit_chunk(recorder);
+
+    pthread_mutex_lock(&recorder->mutex);
+    recorder->stopping = true;
+    pthread_cond_broadcast(&recorder->changed);
+    pthread_mutex_unlock(&recorder->mutex);
+    pthread_join(recorder->thread, NULL);
+    pthread_mutex_destroy(&recorder->mutex);
+    pthread_cond_destroy(&recorder->changed);
+
+    bool failed = atomic_load(&recorder->failed) ||
+                  !write_all(recorder->fd, (image*)header, RECORDING_ALIGNMENT, 0) ||
+                  fdatasync(recorder->fd) == -1;
+    if (failed) fprintf(stderr, "Failed to finish the recording: %s.", strerror(errno));
+    free_recorder(recorder);
+    return failed ? RECORDING_FAILED : SUCCESS;
+}
+
+// Rebuilds the index of [recording] from its record headers, for recordings whose
+// recorder never closed them. Records that were cut off are left out.
+void rebuild_index(recording_t* recording) {
+    size_t capacity = 1024, count = 0;
+    recorded_frame_t* index = (recorded_frame_t*)malloc(capacity * sizeof(recorded_frame_t));
+    size_t offset = RECORDING_ALIGNMENT;
+    while (offset + RECORD_HEADER_SIZE <= recording->size) {
+        const record_header_t* record = (const record_header_t*)(recording->data + offset);
+        if (record->magic != RECORD_MAGIC) {
+            // the rest of a chunk is padding, the next chunk starts on the next page
+            size_t next_chunk = round_up(offset, RECORDING_ALIGNMENT);
+            if (next_chunk == offset) break;
+            offset = next_chunk;
+            continue;
+        }
+        if (record->frame.offset != offset + RECORD_HEADER_SIZE ||
+            record->frame.payload_size > recording->size - record->frame.offset)
+            break;
+
+        if (count == capacity) {
+            capacity *= 2;
+            index = (recorded_frame_t*)realloc(index, capacity * sizeof(recorded_frame_t));
+        }
+        index[count++] = record->frame;
+        offset += round_up(RECORD_HEADER_SIZE + record->frame.payload_size, RECORD_ALIGNMENT);
+    }
+    recording->rebuilt_index = index;
+    recording->index = index;
+    recording->frame_count = count;
+}
+
+recording_t* open_recording(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "Failed to open recording \"%s\": %s.", path, strerror(errno));
+        return NULL;
+    }
+    struct stat file;
+    if (fstat(fd, &file) == -1 || (size_t)file.st_size < RECORDING_ALIGNMENT) {
+        fprintf(stderr, "\"%s\" is not a recording.", path);
+        close(fd);
+        return NULL;
+    }
+    const image* data = (const image*)mmap(NULL, file.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Failed to map recording \"%s\": %s.", path, strerror(errno));
+        return NULL;
+    }
+    const recording_header_t* header = (const recording_header_t*)data;
+    if (header->magic != RECORDING_MAGIC || header->version != RECORDING_VERSION) {
+        fprintf(stderr, "\"%s\" is not a recording of version %u.", path, RECORDING_VERSION);
+        munmap((void*)data, file.st_size);
+        return NULL;
+    }
+    // replays mostly run through the file front to back
+    madvise((void*)data, file.st_size, MADV_SEQUENTIAL);
+
+    recording_t* recording = (recording_t*)calloc(1, sizeof(recording_t));
+    recording->data = data;
+    recording->size = file.st_size;
+    recording->header = header;
+    size_t index_size = header->frame_count * sizeof(recorded_frame_t);
+    if (header->index_offset != 0 && header->index_offset <= recording->size &&
+        index_size <= recording->size - header->index_offset) {
+        recording->index = (const recorded_frame_t*)(data + header->index_offset);
+        recording->frame_count = header->frame_count;
+    } else {
+        fprintf(stderr, "Recording \"%s\" was not closed, rebuilding its index.", path);
+        rebuild_index(recording);
+    }
+    return recording;
+}
+
+size_t recording_frame_count(const recording_t* recording) {
+    return recording->frame_count;
+}
+
+const recorded_frame_t* recording_frame(const recording_t* recording, size_t index) {
+    return index < recording->frame_count ? &recording->index[index] : NULL;
+}
+
+const image* recording_frame_data(const recording_t* recording, size_t index) {
+    const recorded_frame_t* frame = recording_frame(recording, index);
+    return frame != NULL ? recording->data + frame->offset : NULL;
+}
+
+image_format_t recording_image_format(const recording_t* recording) {
+    return recording->header->format;
+}
+
+block_t* create_replay_block(const char* direction, const recording_t* recording,
+                             const block_options_t* options) {
+    const recording_header_t* header = recording->header;
+    block_options_t replay_options = *options;
+    replay_options.timestamp_unit = header->timestamp_unit;
+    return create_block_with_format(direction, header->width, header->height, header->depth,
+                                    &header->format, header->payload_capacity,
+                                    &replay_options);
+}
+
+int replay_frame(block_t* block, const recording_t* recording, size_t index) {
+    const recorded_frame_t* frame = recording_frame(recording, index);
+    if (frame == NULL) return NO_NEW_FRAME;
+    // raw frames have to fill the block's images, see [commit_write_packet]
+    if (frame->codec == CODEC_RAW && frame->payload_size != block_image_size(block))
+        return FRAME_SIZE_MISMATCH;
+    // the slot is filled straight from the mapped file, with a single copy
+    return write_packet(block, recording->data + frame->offset, frame->payload_size,
+                        frame->codec, frame->acquisition_time);
+}
+
+void close_recording(recording_t* recording) {
+    munmap((void*)recording->data, recording->size);
+    free(recording->rebuilt_index);
+    free(recording);
+}
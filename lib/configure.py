@@ -1,5 +1,7 @@
 #!/usr/bin/env python3
+import os
 import sys
+import sysconfig
 from ninja_syntax import Writer
 
 outfile = sys.argv[1]
@@ -10,5 +12,27 @@ ninja = Writer(output=open(outfile, 'w'))
 ninja.variable('builddir', builddir)
 
 ninja.build('$builddir/buffer.o', 'cc', 'lib/c/buffer.c')
-ninja.build('$builddir/libbuffer.so', 'cc-shared',
-            '$builddir/buffer.o', implicit=['$builddir/buffer.o'])
+# the conversion kernels rely on the vectorizer, so they are optimized in debug builds too
+ninja.build('$builddir/convert.o', 'cc', 'lib/c/convert.c',
+            variables={'cflags': '$cflags -O3'})
+ninja.build('$builddir/record.o', 'cc', 'lib/c/record.c')
+
+objects = ['$builddir/buffer.o', '$builddir/convert.o', '$builddir/record.o']
+libs = ''
+# set by the root configure.py when BUILD_CUDA is enabled
+cuda = os.environ.get('FRAMEBUFFER_CUDA')
+if cuda:
+    ninja.build('$builddir/cuda.o', 'cc', 'lib/c/cuda.c',
+                variables={'cflags': f'$cflags -DFRAMEBUFFER_CUDA -I{cuda}/include'})
+    objects += ['$builddir/cuda.o']
+    libs = f'-L{cuda}/lib64 -Wl,-rpath,{cuda}/lib64 -lcudart'
+ninja.build('$builddir/libbuffer.so', 'cc-shared', objects, variables={'libs': libs})
+
+# the Python extension links the objects itself, so it needs no library path to load
+ninja.build('$builddir/_framebuffer.o', 'cc', 'lib/c/_framebuffer.c',
+            variables={'cflags': f"$cflags -Ilib/c -I{sysconfig.get_paths()['include']}"})
+extension = f"$builddir/_framebuffer{sysconfig.get_config_var('EXT_SUFFIX')}"
+ninja.build(extension, 'cc-shared',
+            ['$builddir/_framebuffer.o', '$builddir/buffer.o', '$builddir/convert.o'])
+
+ninja.default(['$builddir/libbuffer.so', extension])
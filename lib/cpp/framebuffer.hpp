@@ -0,0 +1,437 @@
+#pragma once
+/* framebuffer.hpp is a header-only C++20 interface to buffer.h. Blocks, frames and frame
+ * views are owned by RAII handles, so a block is always closed (or destroyed by its
+ * writer) and a view always releases its slot, even when an exception unwinds the stack.
+ *
+ * Every class is templated on the pixel type of the block, e.g. [Bgr8] or [Gray16]. The
+ * pixel type fixes the element type and channel count at compile time, so images are
+ * handed out as std::span<const uint8_t> or std::span<const uint16_t> instead of raw bytes,
+ * and a reader refuses to open a block whose images are of another type.
+ *
+ * Errors that leave the caller nothing to do but give up (the block does not exist, the
+ * writer died, a frame does not fit) are thrown as [framebuffer::Error], which carries the
+ * error code of buffer.h. Running out of new frames is not an error: reads return false
+ * or an empty std::optional, like the C functions return NO_NEW_FRAME.
+ *
+ *  usage:
+ *      framebuffer::Writer<framebuffer::Bgr8> writer("forward", 640, 480);
+ *      writer.write(image, now());
+ *
+ *      framebuffer::Reader<framebuffer::Bgr8> reader("forward");
+ *      while (auto view = reader.acquire()) {
+ *          for (size_t y = 0; y < view->height(); y++) detect(view->row(y));
+ *      }   // the slot is released here
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "../c/buffer.h"
+
+namespace framebuffer {
+
+// tags for the order of the channels of a [Pixel]. Blocks do not record it, it only keeps
+// e.g. [Bgr8] and [Rgb8] images apart at compile time
+namespace order {
+struct bgr {};
+struct bgra {};
+struct rgb {};
+}  // namespace order
+
+// A pixel of [Channels] interleaved elements of type [Element], in the channel [Order].
+template <typename Element, size_t Channels, typename Order = void>
+struct Pixel {
+    using element_type = Element;
+    using order_type = Order;
+    static constexpr size_t channels = Channels;
+};
+
+using Bgr8 = Pixel<uint8_t, 3, order::bgr>;
+using Bgra8 = Pixel<uint8_t, 4, order::bgra>;
+using Rgb8 = Pixel<uint8_t, 3, order::rgb>;
+using Gray8 = Pixel<uint8_t, 1>;
+using Gray16 = Pixel<uint16_t, 1>;
+using Depth32f = Pixel<float, 1>;
+
+// the PIXEL_FORMAT_* value of blocks holding images of [Element]
+template <typename Element>
+constexpr int pixel_format_of() {
+    if constexpr (std::is_same_v<Element, uint8_t>)
+        return PIXEL_FORMAT_U8;
+    else if constexpr (std::is_same_v<Element, uint16_t>)
+        return PIXEL_FORMAT_U16;
+    else if constexpr (std::is_same_v<Element, float>)
+        return PIXEL_FORMAT_F32;
+    else
+        static_assert(sizeof(Element) == 0, "blocks hold uint8_t, uint16_t or float images");
+}
+
+// An error reported by buffer.h. [code] is one of its exit codes, e.g. BLOCK_NOT_ACTIVE,
+// or -1 if a block could not be created or opened.
+class Error : public std::runtime_error {
+   public:
+    Error(int code, const std::string& what) : std::runtime_error(what), code_(code) {}
+    int code() const { return code_; }
+
+   private:
+    int code_;
+};
+
+namespace detail {
+
+// Throws unless [exit_code] is one of the codes that are part of normal operation.
+inline int check(int exit_code, const char* operation) {
+    switch (exit_code) {
+        case SUCCESS:
+        case NO_NEW_FRAME:
+        case FRAME_DROPPED:
+        case FRAME_OVERWRITTEN:
+            return exit_code;
+        default:
+            throw Error(exit_code, std::string(operation) + " failed with exit code " +
+                                       std::to_string(exit_code));
+    }
+}
+
+// Throws if images laid out as [format] are not made of pixels of type [P].
+template <typename P>
+void check_format(const image_format_t& format, const std::string& name) {
+    if (format.pixel_format != pixel_format_of<typename P::element_type>() ||
+        format.planes[0].channels != P::channels)
+        throw Error(FRAME_SIZE_MISMATCH,
+                    "the images of \"" + name + "\" are not of the requested pixel type");
+}
+
+// The rows of an image laid out as [format] at [data], as spans of elements.
+template <typename P, typename Byte>
+auto row(Byte* data, const image_format_t& format, size_t y) {
+    using Element = std::conditional_t<std::is_const_v<Byte>, const typename P::element_type,
+                                       typename P::element_type>;
+    const plane_t& plane = format.planes[0];
+    return std::span<Element>(reinterpret_cast<Element*>(data + plane.offset + y * plane.stride),
+                              plane.width * P::channels);
+}
+
+}  // namespace detail
+
+// Returns [default_block_options] for blocks of [P]. Override the fields that matter
+// before passing them to [Writer].
+template <typename P>
+block_options_t default_options() {
+    block_options_t options = default_block_options();
+    options.pixel_format = pixel_format_of<typename P::element_type>();
+    return options;
+}
+
+// A frame read by a [Reader]. Its storage is allocated once by the first read and reused
+// by every read after that. Frames are move-only.
+template <typename P>
+class Frame {
+   public:
+    using element_type = typename P::element_type;
+
+    Frame() : frame_(create_frame()) {}
+    // Same as the default constructor, but the storage for any frame of [block] is
+    // allocated up front, see [create_frame_for_block].
+    explicit Frame(const block_t* block, bool page_aligned = false)
+        : frame_(create_frame_for_block(block, page_aligned)) {}
+    Frame(Frame&& other) noexcept : frame_(std::exchange(other.frame_, nullptr)) {}
+    Frame& operator=(Frame&& other) noexcept {
+        std::swap(frame_, other.frame_);
+        return *this;
+    }
+    Frame(const Frame&) = delete;
+    Frame& operator=(const Frame&) = delete;
+    ~Frame() {
+        if (frame_ != nullptr) delete_frame(frame_);
+    }
+
+    size_t width() const { return frame_->width; }
+    size_t height() const { return frame_->height; }
+    static constexpr size_t channels() { return P::channels; }
+    uint64_t acquisition_time() const { return frame_->acquisition_time; }
+    uint64_t uid() const { return frame_->frame_uid; }
+    const image_format_t& format() const { return frame_->format; }
+
+    // every element of the image, including the padding of its rows, if any
+    std::span<const element_type> data() const {
+        return {reinterpret_cast<const element_type*>(frame_->data),
+                frame_->format.size / sizeof(element_type)};
+    }
+    // the [width] * [channels] elements of row [y]
+    std::span<const element_type> row(size_t y) const {
+        return detail::row<P>(static_cast<const image*>(frame_->data), frame_->format, y);
+    }
+
+    frame_t* get() { return frame_; }
+
+   private:
+    frame_t* frame_;
+};
+
+// A frame that still lives in the buffer, see [acquire_frame_view]. The slot it points
+// into is released when the view is destroyed, or earlier with [release]. Views are
+// move-only.
+template <typename P>
+class FrameView {
+   public:
+    using element_type = typename P::element_type;
+
+    FrameView(FrameView&& other) noexcept
+        : block_(std::exchange(other.block_, nullptr)), view_(other.view_) {}
+    FrameView& operator=(FrameView&& other) noexcept {
+        std::swap(block_, other.block_);
+        std::swap(view_, other.view_);
+        return *this;
+    }
+    FrameView(const FrameView&) = delete;
+    FrameView& operator=(const FrameView&) = delete;
+    ~FrameView() { release(); }
+
+    size_t width() const { return view_.width; }
+    size_t height() const { return view_.height; }
+    static constexpr size_t channels() { return P::channels; }
+    uint64_t acquisition_time() const { return view_.acquisition_time; }
+    uint64_t uid() const { return view_.frame_uid; }
+    const image_format_t& format() const { return view_.format; }
+
+    // every element of the image, including the padding of its rows, if any
+    std::span<const element_type> data() const {
+        return {reinterpret_cast<const element_type*>(view_.data),
+                view_.format.size / sizeof(element_type)};
+    }
+    // the [width] * [channels] elements of row [y]
+    std::span<const element_type> row(size_t y) const {
+        return detail::row<P>(view_.data, view_.format, y);
+    }
+
+    // Releases the slot. Returns false if the writer may have overwritten the frame while
+    // it was held (SYNC_SEQLOCK only), in which case anything computed from it should be
+    // dropped. Releasing a released view does nothing.
+    bool release() {
+        if (block_ == nullptr) return true;
+        block_t* block = std::exchange(block_, nullptr);
+        return release_frame_view(block, &view_) != FRAME_OVERWRITTEN;
+    }
+
+   private:
+    template <typename>
+    friend class Reader;
+    FrameView(block_t* block, const frame_view_t& view) : block_(block), view_(view) {}
+
+    block_t* block_;  // nullptr once released
+    frame_view_t view_;
+};
+
+// The writer of a block of [P] images, which owns the block and destroys it.
+template <typename P>
+class Writer {
+   public:
+    using element_type = typename P::element_type;
+
+    // Creates the block [name] for images of [width] * [height] pixels, see
+    // [create_block_ex]. The pixel format of [options] is set from [P]. If the block was
+    // left behind by a writer that crashed, it is reclaimed instead (see [reclaim_block]),
+    // so that its readers stay attached, unless it holds images of another shape.
+    Writer(const std::string& name, size_t width, size_t height,
+           block_options_t options = default_options<P>())
+        : width_(width), height_(height) {
+        options.pixel_format = pixel_format_of<element_type>();
+        block_ = create_block_ex(name.c_str(), width, height, P::channels, &options);
+        if (block_ == nullptr && cstr_block_is_poisoned(name.c_str())) {
+            block_ = reclaim_block(name.c_str());
+            if (block_ != nullptr && !fits()) {
+                destroy_block(block_);
+                block_ = create_block_ex(name.c_str(), width, height, P::channels, &options);
+            }
+        }
+        if (block_ == nullptr) throw Error(-1, "failed to create block \"" + name + "\"");
+    }
+    Writer(Writer&& other) noexcept
+        : block_(std::exchange(other.block_, nullptr)),
+          width_(other.width_),
+          height_(other.height_) {}
+    Writer& operator=(Writer&& other) noexcept {
+        std::swap(block_, other.block_);
+        std::swap(width_, other.width_);
+        std::swap(height_, other.height_);
+        return *this;
+    }
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+    ~Writer() {
+        if (block_ != nullptr) destroy_block(block_);
+    }
+
+    // Writes [image], laid out as described by [block_image_format]. Returns false if the
+    // frame was dropped because of BACKPRESSURE_SKIP.
+    bool write(std::span<const element_type> image, uint64_t acquisition_time) {
+        if (image.size_bytes() != block_image_size(block_))
+            throw Error(FRAME_SIZE_MISMATCH, "the image does not match the block's size");
+        // write_frame never modifies the image
+        auto* data = reinterpret_cast<::image*>(const_cast<element_type*>(image.data()));
+        return detail::check(write_frame(block_, width_, height_, P::channels,
+                                         acquisition_time, data),
+                             "write_frame") == SUCCESS;
+    }
+
+    // Zero-copy variant of [write]: calls [fill] with a writable span of the next slot and
+    // publishes it afterwards, see [begin_write_frame]. If [fill] throws, the frame is
+    // published anyway so that the slot does not stay locked, and the exception is
+    // rethrown. Returns false if the frame was dropped because of BACKPRESSURE_SKIP.
+    template <typename Fill>
+    bool write_in_place(Fill&& fill, uint64_t acquisition_time) {
+        ::image* slot = begin_write_frame(block_);
+        if (slot == nullptr) {
+            if (!block_is_alive(block_)) throw Error(BLOCK_NOT_ACTIVE, "the block is dead");
+            return false;
+        }
+        std::span<element_type> image(reinterpret_cast<element_type*>(slot),
+                                      block_image_size(block_) / sizeof(element_type));
+        try {
+            fill(image);
+        } catch (...) {
+            commit_write_frame(block_, acquisition_time);
+            throw;
+        }
+        detail::check(commit_write_frame(block_, acquisition_time), "commit_write_frame");
+        return true;
+    }
+
+    image_format_t format() const { return block_image_format(block_); }
+    block_t* get() { return block_; }
+
+   private:
+    // whether the reclaimed [block_] holds the images this writer writes
+    bool fits() const {
+        image_format_t image = format();
+        return image.pixel_format == pixel_format_of<element_type>() &&
+               image.planes[0].width == width_ && image.planes[0].height == height_ &&
+               image.planes[0].channels == P::channels;
+    }
+
+    block_t* block_;
+    size_t width_, height_;
+};
+
+// A reader of a block of [P] images, or of one of its derived levels.
+template <typename P>
+class Reader {
+   public:
+    using element_type = typename P::element_type;
+
+    // Opens the block [name], see [open_block_level]. Throws if the block does not exist
+    // or does not hold images of [P].
+    explicit Reader(const std::string& name, size_t level = 0)
+        : block_(open_block_level(name.c_str(), level)) {
+        if (block_ == nullptr) throw Error(-1, "failed to open block \"" + name + "\"");
+        try {
+            detail::check_format<P>(block_image_format(block_), name);
+        } catch (...) {
+            close_block(block_);
+            throw;
+        }
+    }
+    Reader(Reader&& other) noexcept
+        : block_(std::exchange(other.block_, nullptr)), last_uid_(other.last_uid_) {}
+    Reader& operator=(Reader&& other) noexcept {
+        std::swap(block_, other.block_);
+        std::swap(last_uid_, other.last_uid_);
+        return *this;
+    }
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+    ~Reader() {
+        if (block_ != nullptr) close_block(block_);
+    }
+
+    // Registers the reader, see [register_reader].
+    void register_reader(bool reliable) {
+        detail::check(::register_reader(block_, reliable), "register_reader");
+    }
+
+    // Sets how the blocking reads of this reader wait for frames, see [set_wait_policy].
+    // Returns false if the calling thread could not be pinned to the policy's CPU.
+    bool set_wait_policy(const wait_policy_t& policy) {
+        return ::set_wait_policy(block_, &policy);
+    }
+
+    // Reads the next frame into [frame], see [read_frame]. Returns false if [wait] is
+    // false and there is no new frame.
+    bool read(Frame<P>& frame, bool wait = true) {
+        return finish_read(frame, read_frame(block_, start_read(frame), wait), "read_frame");
+    }
+
+    // Reads the next frame into [frame], converted and downscaled on the way out of the
+    // buffer, see [read_frame_converted]. [Q] is the pixel type of the result, e.g. Gray8
+    // for CONVERT_BGR_TO_GRAY.
+    template <typename Q>
+    bool read_converted(Frame<Q>& frame, int conversion, size_t scale, bool wait = true) {
+        int exit_code =
+            read_frame_converted(block_, start_read(frame), conversion, scale, wait);
+        if (!finish_read(frame, exit_code, "read_frame_converted")) return false;
+        detail::check_format<Q>(frame.format(), "the conversion");
+        return true;
+    }
+
+    // Reads the [width] * [height] pixels at [x], [y] of the next frame into [frame], see
+    // [read_frame_roi].
+    bool read_roi(Frame<P>& frame, size_t x, size_t y, size_t width, size_t height,
+                  bool wait = true) {
+        int exit_code = read_frame_roi(block_, start_read(frame), x, y, width, height, wait);
+        return finish_read(frame, exit_code, "read_frame_roi");
+    }
+
+    // Acquires a view of the next frame, see [acquire_frame_view]. Returns an empty
+    // optional if [wait] is false and there is no new frame.
+    std::optional<FrameView<P>> acquire(bool wait = true) {
+        frame_view_t view{};
+        view.frame_uid = last_uid_;
+        return finish_acquire(view, acquire_frame_view(block_, &view, wait),
+                              "acquire_frame_view");
+    }
+
+    // Acquires a strided view of the [width] * [height] pixels at [x], [y] of the next
+    // frame, see [acquire_frame_view_roi].
+    std::optional<FrameView<P>> acquire_roi(size_t x, size_t y, size_t width, size_t height,
+                                            bool wait = true) {
+        frame_view_t view{};
+        view.frame_uid = last_uid_;
+        int exit_code = acquire_frame_view_roi(block_, &view, x, y, width, height, wait);
+        return finish_acquire(view, exit_code, "acquire_frame_view_roi");
+    }
+
+    image_format_t format() const { return block_image_format(block_); }
+    block_t* get() { return block_; }
+
+   private:
+    // reads of every kind share one position in the stream
+    template <typename Q>
+    frame_t* start_read(Frame<Q>& frame) {
+        frame.get()->frame_uid = last_uid_;
+        return frame.get();
+    }
+    template <typename Q>
+    bool finish_read(Frame<Q>& frame, int exit_code, const char* operation) {
+        if (detail::check(exit_code, operation) != SUCCESS) return false;
+        last_uid_ = frame.uid();
+        return true;
+    }
+    std::optional<FrameView<P>> finish_acquire(frame_view_t& view, int exit_code,
+                                               const char* operation) {
+        if (detail::check(exit_code, operation) != SUCCESS) return std::nullopt;
+        last_uid_ = view.frame_uid;
+        return FrameView<P>(block_, view);
+    }
+
+    block_t* block_;
+    uint64_t last_uid_ = 0;
+};
+
+}  // namespace framebuffer
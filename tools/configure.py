@@ -0,0 +1,28 @@
+#!/usr/bin/env python3
+import sys
+from ninja_syntax import Writer
+
+outfile = sys.argv[1]
+builddir = f"{outfile.replace('build.ninja', 'binaries')}"
+
+
+ninja = Writer(output=open(outfile, 'w'))
+ninja.variable('builddir', builddir)
+
+ninja.build('$builddir/fbtop.o', 'cc', 'tools/fbtop.c',
+            variables={'cflags': '$cflags -Ilib/c'})
+ninja.build('$builddir/fbtop', 'cc-exe',
+            ['$builddir/fbtop.o', 'lib/binaries/buffer.o',
+             'lib/binaries/convert.o'],
+            variables={'libs': '-lpthread'})
+
+for tool in ['fbrecord', 'fbreplay', 'fbbridge']:
+    ninja.build(f'$builddir/{tool}.o', 'cc', f'tools/{tool}.c',
+                variables={'cflags': '$cflags -Ilib/c'})
+    ninja.build(f'$builddir/{tool}', 'cc-exe',
+                [f'$builddir/{tool}.o', 'lib/binaries/buffer.o',
+                 'lib/binaries/convert.o', 'lib/binaries/record.o'],
+                variables={'libs': '-lpthread'})
+
+ninja.default(['$builddir/fbtop', '$builddir/fbrecord', '$builddir/fbreplay',
+               '$builddir/fbbridge'])
@@ -0,0 +1,573 @@
+// Republishes a block on another machine, so that readers there can open it like any
+// local block.
+//
+// The receiving side listens for bridges and creates a block of the same name (and
+// layout) for every one that connects. The sending side reads a local block and streams
+// its frames over TCP. When the link is slower than the writer, the sender skips to
+// the newest frame whenever it is ready for another one, so the remote readers fall
+// behind by at most a frame or two instead of an ever growing queue. When the local
+// block is destroyed, so is the remote one, and the sender waits for the block to come
+// back.
+//
+// usage:
+//      fbbridge listen [--bind ADDRESS] [--port PORT] [--max-frame-bytes N] [--slots N]
+//                      [--lock-free]
+//      fbbridge send [--level N] direction host[:port]
+//
+// Bridges are not authenticated, so the listener only accepts connections from the
+// loopback interface unless --bind names another address, e.g. :: for every interface.
+// --max-frame-bytes bounds the images (and payloads) of the blocks that bridges may
+// create, [DEFAULT_MAX_FRAME_BYTES] by default.
+//
+// --level streams a derived level of the block (see [open_block_level]), e.g. a
+// downscaled one, to save bandwidth. Blocks of encoded payloads (see [write_packet]) are
+// sent as they are, so a JPEG or H.264 stream crosses the link compressed.
+//
+// Payloads are copied out of their slot once, as soon as they are read, so that the
+// slot is not held for as long as the network takes. Large payloads are then sent with
+// MSG_ZEROCOPY from that copy, which saves the kernel another copy; [SEND_BUFFERS]
+// copies are in flight at most.
+#include "buffer.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <getopt.h>
+#include <linux/errqueue.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define DEFAULT_PORT "7117"
+#define DEFAULT_BIND_ADDRESS "127.0.0.1"
+#define DEFAULT_MAX_FRAME_BYTES (256ul << 20)
+#define BRIDGE_MAGIC FOURCC('F', 'B', 'B', 'R')
+#define BRIDGE_VERSION 2
+// payloads smaller than this are copied into the socket, MSG_ZEROCOPY costs more than it
+// saves on them
+#define ZEROCOPY_THRESHOLD (16 * 1024)
+#define SEND_BUFFERS 4
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+// Everything on the wire is a big endian uint64_t. A bridge opens with a hello that
+// describes the block, followed by [direction_length] bytes of its name. Every frame is a
+// frame header followed by [payload_size] bytes.
+typedef struct bridge_hello {
+    uint64_t magic, version;
+    uint64_t width, height, depth;
+    uint64_t payload_capacity;
+    uint64_t pixel_format, element_type, element_size, plane_count;
+    uint64_t planes[MAX_PLANES][5];  // offset, width, height, channels, stride
+    uint64_t size;
+    uint64_t timestamp_unit;
+    uint64_t direction_length;
+} bridge_hello_t;
+
+typedef struct bridge_frame {
+    uint64_t acquisition_time;
+    uint64_t codec;
+    uint64_t payload_size;
+} bridge_frame_t;
+
+// A copy of a frame that is being sent, header first. [last_send] is the MSG_ZEROCOPY send
+// whose completion frees it.
+typedef struct send_buffer {
+    unsigned char* data;
+    bool in_flight;
+    uint32_t last_send;
+} send_buffer_t;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void interrupt(int signal) {
+    interrupted = 1;
+}
+
+static void to_wire(void* message, size_t size) {
+    uint64_t* words = message;
+    for (size_t i = 0; i < size / sizeof(uint64_t); i++) words[i] = htobe64(words[i]);
+}
+
+static void from_wire(void* message, size_t size) {
+    uint64_t* words = message;
+    for (size_t i = 0; i < size / sizeof(uint64_t); i++) words[i] = be64toh(words[i]);
+}
+
+// Receives exactly [size] bytes. Returns false if the connection ended first.
+static bool receive_all(int socket, void* data, size_t size) {
+    unsigned char* bytes = data;
+    while (size > 0) {
+        ssize_t received = recv(socket, bytes, size, 0);
+        if (received == -1 && errno == EINTR && !interrupted) continue;
+        if (received <= 0) return false;
+        bytes += received;
+        size -= received;
+    }
+    return true;
+}
+
+/* ############################################################################
+ * The receiving side
+ * ############################################################################
+ */
+
+// Creates the block described by [hello]. A block left behind by a bridge that died is
+// taken over if it has the same layout, and replaced otherwise.
+static block_t* create_bridged_block(const char* direction, const bridge_hello_t* hello,
+                                     const block_options_t* options) {
+    // the frames keep the acquisition times of the sending side
+    block_options_t bridged_options = *options;
+    bridged_options.timestamp_unit = hello->timestamp_unit;
+    image_format_t format = {
+        .pixel_format = hello->pixel_format,
+        .element_type = hello->element_type,
+        .element_size = hello->element_size,
+        .plane_count = hello->plane_count,
+        .size = hello->size,
+    };
+    for (size_t i = 0; i < MAX_PLANES; i++) {
+        format.planes[i] = (plane_t){hello->planes[i][0], hello->planes[i][1],
+                                     hello->planes[i][2], hello->planes[i][3],
+                                     hello->planes[i][4]};
+    }
+
+    block_t* block = create_block_with_format(direction, hello->width, hello->height,
+                                              hello->depth, &format, hello->payload_capacity,
+                                              &bridged_options);
+    if (block != NULL || !cstr_block_is_poisoned(direction)) return block;
+
+    block_t* stale = reclaim_block(direction);
+    if (stale == NULL) return NULL;
+    image_format_t stale_format = block_image_format(stale);
+    if (same_image_format(&stale_format, &format) &&
+        block_payload_capacity(stale) == hello->payload_capacity &&
+        block_timestamp_unit(stale) == (int)hello->timestamp_unit)
+        return stale;
+    destroy_block(stale);
+    return create_block_with_format(direction, hello->width, hello->height, hello->depth,
+                                    &format, hello->payload_capacity, &bridged_options);
+}
+
+// Republishes the frames of the bridge connected to [connection] until it disconnects.
+// Bridges of blocks whose images or payloads exceed [max_frame_bytes] are turned away.
+static int receive_bridge(int connection, const block_options_t* options,
+                          size_t max_frame_bytes) {
+    bridge_hello_t hello;
+    if (!receive_all(connection, &hello, sizeof(hello))) return 1;
+    from_wire(&hello, sizeof(hello));
+    if (hello.magic != BRIDGE_MAGIC || hello.version != BRIDGE_VERSION ||
+        hello.plane_count > MAX_PLANES || hello.direction_length == 0 ||
+        hello.direction_length > 255) {
+        fprintf(stderr, "Rejected a connection that is not a bridge of version %d.\n",
+                BRIDGE_VERSION);
+        return 1;
+    }
+    // the layout in [hello] is checked against the one the dimensions give when the block
+    // is created, which fails for dimensions whose image size does not fit a size_t
+    if (hello.size > max_frame_bytes || hello.payload_capacity > max_frame_bytes) {
+        fprintf(stderr, "Rejected a bridge of frames larger than %zu bytes.\n",
+                max_frame_bytes);
+        return 1;
+    }
+    char direction[256];
+    if (!receive_all(connection, direction, hello.direction_length)) return 1;
+    direction[hello.direction_length] = '\0';
+
+    block_t* block = create_bridged_block(direction, &hello, options);
+    if (block == NULL) return 1;
+    size_t capacity = block_payload_capacity(block);
+    // frames dropped for reliable readers (BACKPRESSURE_SKIP) still have to be drained
+    image* discard = malloc(capacity);
+    if (discard == NULL) {
+        destroy_block(block);
+        return 1;
+    }
+
+    size_t frames = 0;
+    bridge_frame_t frame;
+    while (receive_all(connection, &frame, sizeof(frame))) {
+        from_wire(&frame, sizeof(frame));
+        if (frame.payload_size > capacity ||
+            (frame.codec == CODEC_RAW && frame.payload_size != block_image_size(block))) {
+            fprintf(stderr, "Received a frame of %s that does not fit its block.\n",
+                    direction);
+            break;
+        }
+        // the payload is received straight into the slot. A bridge that disconnects
+        // halfway through a frame destroys the block below, so readers never see it
+        image* slot = begin_write_frame(block);
+        if (!receive_all(connection, slot ? slot : discard, frame.payload_size)) break;
+        if (slot != NULL &&
+            commit_write_packet(block, frame.payload_size, frame.codec,
+                                frame.acquisition_time) != SUCCESS)
+            break;
+        frames++;
+    }
+
+    free(discard);
+    destroy_block(block);
+    printf("bridged %zu frames of %s\n", frames, direction);
+    return 0;
+}
+
+static int listen_for_bridges(const char* bind_address, const char* port,
+                              const block_options_t* options, size_t max_frame_bytes) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM,
+                             .ai_flags = AI_PASSIVE};
+    struct addrinfo* address;
+    int error = getaddrinfo(bind_address, port, &hints, &address);
+    if (error != 0) {
+        fprintf(stderr, "Invalid address \"%s\" or port \"%s\": %s.\n", bind_address, port,
+                gai_strerror(error));
+        return 1;
+    }
+    int listener = socket(address->ai_family, address->ai_socktype, 0);
+    int yes = 1, no = 0;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    // :: accepts IPv4 bridges as well
+    if (address->ai_family == AF_INET6)
+        setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no));
+    if (listener == -1 || bind(listener, address->ai_addr, address->ai_addrlen) == -1 ||
+        listen(listener, 16) == -1) {
+        fprintf(stderr, "Failed to listen on %s:%s: %s.\n", bind_address, port,
+                strerror(errno));
+        freeaddrinfo(address);
+        return 1;
+    }
+    freeaddrinfo(address);
+
+    // every bridge is served by its own process, which exits with it
+    signal(SIGCHLD, SIG_IGN);
+    struct pollfd ready = {.fd = listener, .events = POLLIN};
+    while (!interrupted) {
+        if (poll(&ready, 1, 100) != 1) continue;
+        int connection = accept(listener, NULL, NULL);
+        if (connection == -1) continue;
+        if (fork() == 0) {
+            close(listener);
+            exit(receive_bridge(connection, options, max_frame_bytes));
+        }
+        close(connection);
+    }
+    close(listener);
+    return 0;
+}
+
+/* ############################################################################
+ * The sending side
+ * ############################################################################
+ */
+
+// Connects to the bridge listening at [host]:[port], or returns -1
+static int connect_bridge(const char* host, const char* port) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo* addresses;
+    if (getaddrinfo(host, port, &hints, &addresses) != 0) return -1;
+    int connection = -1;
+    for (struct addrinfo* address = addresses; address != NULL && connection == -1;
+         address = address->ai_next) {
+        connection = socket(address->ai_family, address->ai_socktype, 0);
+        if (connection != -1 && connect(connection, address->ai_addr, address->ai_addrlen) == -1) {
+            close(connection);
+            connection = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (connection == -1) return -1;
+
+    int yes = 1;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    return connection;
+}
+
+// The state of a connected sender
+typedef struct sender {
+    int connection;
+    bool zerocopy;       // whether the socket accepts MSG_ZEROCOPY
+    uint32_t sends;      // MSG_ZEROCOPY sends made so far
+    uint32_t completed;  // MSG_ZEROCOPY sends the kernel is done with
+    send_buffer_t buffers[SEND_BUFFERS];
+} sender_t;
+
+// Collects the MSG_ZEROCOPY completions queued on the socket. Returns false if the
+// connection failed.
+static bool collect_completions(sender_t* sender) {
+    while (true) {
+        char control[128];
+        struct msghdr message = {.msg_control = control, .msg_controllen = sizeof(control)};
+        if (recvmsg(sender->connection, &message, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != NULL;
+             header = CMSG_NXTHDR(&message, header)) {
+            struct sock_extended_err* error = (struct sock_extended_err*)CMSG_DATA(header);
+            if (error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) return false;
+            // [ee_info, ee_data] is the range of sends that completed, in order
+            if ((int32_t)(error->ee_data + 1 - sender->completed) > 0)
+                sender->completed = error->ee_data + 1;
+        }
+    }
+}
+
+// Waits until the kernel no longer references [buffer]
+static bool wait_for_buffer(sender_t* sender, send_buffer_t* buffer) {
+    while (buffer->in_flight) {
+        if (!collect_completions(sender)) return false;
+        if ((int32_t)(sender->completed - buffer->last_send) > 0) {
+            buffer->in_flight = false;
+            break;
+        }
+        // completions are reported as socket errors
+        struct pollfd ready = {.fd = sender->connection, .events = 0};
+        if (poll(&ready, 1, 100) == -1 && errno != EINTR) return false;
+        if (interrupted) return false;
+    }
+    return true;
+}
+
+// Sends the [size] bytes of [buffer]. Returns false if the connection failed.
+static bool send_buffer(sender_t* sender, send_buffer_t* buffer, size_t size) {
+    bool zerocopy = sender->zerocopy && size >= ZEROCOPY_THRESHOLD;
+    size_t sent = 0;
+    while (sent < size) {
+        ssize_t result = send(sender->connection, buffer->data + sent, size - sent,
+                              MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+        if (result == -1) {
+            if (errno == EINTR) continue;
+            // the kernel may run out of memory to pin pages with, the rest is copied
+            if (errno == ENOBUFS && zerocopy) {
+                zerocopy = false;
+                continue;
+            }
+            return false;
+        }
+        if (zerocopy) {
+            buffer->in_flight = true;
+            buffer->last_send = sender->sends++;
+        }
+        sent += result;
+    }
+    return true;
+}
+
+// Streams the frames of [block] to [sender] until the block or the connection dies.
+// Returns BLOCK_NOT_ACTIVE for the former.
+static int send_frames(sender_t* sender, block_t* block, const char* direction,
+                       size_t* frames) {
+    size_t capacity = block_payload_capacity(block);
+    frame_view_t view = {0};
+    struct pollfd ready = {.fd = block_notify_fd(block), .events = POLLIN};
+    bool greeted = false;
+    for (size_t next = 0; !interrupted; next = (next + 1) % SEND_BUFFERS) {
+        send_buffer_t* buffer = &sender->buffers[next];
+        if (!wait_for_buffer(sender, buffer)) return SUCCESS;
+
+        // only the newest frame is sent, which drops the frames written while the
+        // previous one was on its way
+        size_t acquired;
+        int exit_code = acquire_frame_views(block, &view, 1, &acquired, false);
+        if (exit_code == NO_NEW_FRAME) {
+            poll(&ready, 1, 100);
+            next = (next + SEND_BUFFERS - 1) % SEND_BUFFERS;
+            continue;
+        }
+        if (exit_code != SUCCESS) return exit_code;
+        bridge_frame_t header = {
+            .acquisition_time = view.acquisition_time,
+            .codec = view.codec,
+            .payload_size = view.payload_size,
+        };
+        memcpy(buffer->data + sizeof(header), view.data, view.payload_size);
+        if (release_frame_view(block, &view) != SUCCESS) continue;
+
+        if (!greeted) {
+            image_format_t format = block_image_format(block);
+            size_t direction_length = strlen(direction);
+            bridge_hello_t hello = {
+                .magic = BRIDGE_MAGIC,
+                .version = BRIDGE_VERSION,
+                .width = view.width,
+                .height = view.height,
+                .depth = view.depth,
+                .payload_capacity = capacity,
+                .pixel_format = format.pixel_format,
+                .element_type = format.element_type,
+                .element_size = format.element_size,
+                .plane_count = format.plane_count,
+                .size = format.size,
+                .timestamp_unit = block_timestamp_unit(block),
+                .direction_length = direction_length,
+            };
+            for (size_t i = 0; i < format.plane_count; i++) {
+                const plane_t* plane = &format.planes[i];
+                uint64_t fields[5] = {plane->offset, plane->width, plane->height,
+                                      plane->channels, plane->stride};
+                memcpy(hello.planes[i], fields, sizeof(fields));
+            }
+            to_wire(&hello, sizeof(hello));
+            if (send(sender->connection, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello) ||
+                send(sender->connection, direction, direction_length, MSG_NOSIGNAL) !=
+                    (ssize_t)direction_length)
+                return SUCCESS;
+            greeted = true;
+        }
+
+        to_wire(&header, sizeof(header));
+        memcpy(buffer->data, &header, sizeof(header));
+        if (!send_buffer(sender, buffer, sizeof(header) + view.payload_size)) return SUCCESS;
+        (*frames)++;
+    }
+    return SUCCESS;
+}
+
+static int send_block(const char* direction, size_t level, const char* host,
+                      const char* port) {
+    while (!interrupted) {
+        block_t* block = NULL;
+        while (block == NULL && !interrupted) block = wait_for_block(direction, level, 100);
+        if (block == NULL) break;
+
+        sender_t sender = {0};
+        size_t capacity = block_payload_capacity(block);
+        for (size_t i = 0; i < SEND_BUFFERS; i++)
+            sender.buffers[i].data = malloc(sizeof(bridge_frame_t) + capacity);
+
+        int exit_code = SUCCESS;
+        while (exit_code != BLOCK_NOT_ACTIVE && !interrupted) {
+            sender.connection = connect_bridge(host, port);
+            if (sender.connection == -1) {
+                sleep(1);
+                // the block may have died in the meantime
+                if (!block_is_alive(block)) break;
+                continue;
+            }
+            int yes = 1;
+            sender.zerocopy = setsockopt(sender.connection, SOL_SOCKET, SO_ZEROCOPY, &yes,
+                                         sizeof(yes)) == 0;
+            // completions are counted per socket
+            sender.sends = sender.completed = 0;
+            for (size_t i = 0; i < SEND_BUFFERS; i++) sender.buffers[i].in_flight = false;
+
+            size_t frames = 0;
+            exit_code = send_frames(&sender, block, direction, &frames);
+            // the receiver destroys its block when the connection closes
+            close(sender.connection);
+            printf("sent %zu frames of %s to %s:%s\n", frames, direction, host, port);
+            fflush(stdout);
+        }
+
+        for (size_t i = 0; i < SEND_BUFFERS; i++) free(sender.buffers[i].data);
+        close_block(block);
+    }
+    return 0;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: fbbridge listen [--bind ADDRESS] [--port PORT] [--max-frame-bytes N]\n"
+            "                       [--slots N] [--lock-free]\n"
+            "       fbbridge send [--level N] direction host[:port]\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        usage();
+        return 2;
+    }
+    bool listening = strcmp(argv[1], "listen") == 0;
+    if (!listening && strcmp(argv[1], "send") != 0) {
+        usage();
+        return 2;
+    }
+
+    const char* port = DEFAULT_PORT;
+    const char* bind_address = DEFAULT_BIND_ADDRESS;
+    size_t max_frame_bytes = DEFAULT_MAX_FRAME_BYTES;
+    size_t level = 0;
+    block_options_t options = default_block_options();
+    static struct option long_options[] = {
+        {"bind", required_argument, NULL, 'b'},
+        {"port", required_argument, NULL, 'p'},
+        {"max-frame-bytes", required_argument, NULL, 'm'},
+        {"slots", required_argument, NULL, 'n'},
+        {"lock-free", no_argument, NULL, 'f'},
+        {"level", required_argument, NULL, 'l'},
+        {NULL, 0, NULL, 0},
+    };
+    int option;
+    optind = 2;
+    while ((option = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (option) {
+            case 'b':
+                bind_address = optarg;
+                break;
+            case 'p':
+                port = optarg;
+                break;
+            case 'm':
+                max_frame_bytes = strtoull(optarg, NULL, 10);
+                break;
+            case 'n':
+                options.slot_count = strtoull(optarg, NULL, 10);
+                break;
+            case 'f':
+                options.sync_mode = SYNC_SEQLOCK;
+                break;
+            case 'l':
+                level = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                usage();
+                return 2;
+        }
+    }
+
+    // blocking calls return early on an interrupt, rather than being restarted
+    struct sigaction stop = {.sa_handler = interrupt};
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+    if (listening) {
+        if (argc - optind != 0) {
+            usage();
+            return 2;
+        }
+        return listen_for_bridges(bind_address, port, &options, max_frame_bytes);
+    }
+
+    if (argc - optind != 2) {
+        usage();
+        return 2;
+    }
+    // host[:port], where an IPv6 address needs brackets to be followed by a port
+    char* address = strdup(argv[optind + 1]);
+    char* host = address;
+    if (host[0] == '[') {
+        host++;
+        char* end = strchr(host, ']');
+        if (end != NULL) {
+            *end = '\0';
+            if (end[1] == ':') port = end + 2;
+        }
+    } else {
+        char* colon = strchr(host, ':');
+        // more than one colon is a bare IPv6 address
+        if (colon != NULL && colon == strrchr(host, ':')) {
+            *colon = '\0';
+            port = colon + 1;
+        }
+    }
+    int exit_code = send_block(argv[optind], level, host, port);
+    free(address);
+    return exit_code;
+}
@@ -0,0 +1,89 @@
+// Records the frames published to a block into a file, see [create_recorder].
+//
+// Waits for the block to be created, then records its frames until the block is
+// destroyed, [--frames] frames were recorded or the process is interrupted. The recording
+// can be replayed with fbreplay.
+//
+// usage:
+//      fbrecord [--frames N] [--reliable] direction file
+//
+// --reliable registers the recorder as a reliable reader (see [register_reader]), so that
+// a writer with back-pressure does not overwrite frames before they are recorded.
+#include "buffer.h"
+
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void interrupt(int signal) {
+    interrupted = 1;
+}
+
+int main(int argc, char** argv) {
+    size_t max_frames = 0;
+    bool reliable = false;
+
+    static struct option long_options[] = {
+        {"frames", required_argument, NULL, 'f'},
+        {"reliable", no_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (option) {
+            case 'f':
+                max_frames = strtoull(optarg, NULL, 10);
+                break;
+            case 'r':
+                reliable = true;
+                break;
+            default:
+                return 2;
+        }
+    }
+    if (argc - optind != 2) {
+        fprintf(stderr, "usage: fbrecord [--frames N] [--reliable] direction file\n");
+        return 2;
+    }
+    const char* direction = argv[optind];
+    const char* path = argv[optind + 1];
+
+    signal(SIGINT, interrupt);
+    signal(SIGTERM, interrupt);
+
+    block_t* block = NULL;
+    while (block == NULL && !interrupted) block = wait_for_block(direction, 0, 100);
+    if (block == NULL) return 1;
+    if (reliable && register_reader(block, true) != SUCCESS) return 1;
+    recorder_t* recorder = create_recorder(path, block);
+    if (recorder == NULL) return 1;
+
+    // the notification fd lets the loop notice interruptions while no frames arrive
+    struct pollfd ready = {.fd = block_notify_fd(block), .events = POLLIN};
+    size_t overwritten = 0;
+    int exit_code = SUCCESS;
+    while (!interrupted && (max_frames == 0 || recorder_frame_count(recorder) < max_frames)) {
+        exit_code = record_frame(recorder, false);
+        if (exit_code == FRAME_OVERWRITTEN) {
+            overwritten++;
+            continue;
+        }
+        if (exit_code == NO_NEW_FRAME) {
+            poll(&ready, 1, 100);
+            continue;
+        }
+        if (exit_code != SUCCESS) break;
+    }
+
+    size_t recorded = recorder_frame_count(recorder);
+    bool failed = close_recorder(recorder) != SUCCESS || exit_code == RECORDING_FAILED;
+    close_block(block);
+    printf("recorded %zu frames of %s to %s", recorded, direction, path);
+    if (overwritten > 0) printf(", %zu frames were overwritten while they were recorded", overwritten);
+    printf("\n");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,117 @@
+// Replays a recording made with fbrecord into a new block, see [replay_frame].
+//
+// Frames are published with their original acquisition times, [--speed] times as fast as
+// they were recorded (in the timestamp unit of the recorded block). A speed of 0
+// publishes them as fast as possible, e.g. to benchmark the readers. The block is
+// destroyed once the recording ends, unless [--loop] replays it over and over. The exit
+// status is 1 if a frame could not be replayed.
+//
+// usage:
+//      fbreplay [--speed FACTOR] [--loop] [--slots N] [--lock-free] file direction
+#include "buffer.h"
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void interrupt(int signal) {
+    interrupted = 1;
+}
+
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns) {
+    struct timespec until = {ns / 1000000000ull, ns % 1000000000ull};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+}
+
+int main(int argc, char** argv) {
+    double speed = 1.0;
+    bool loop = false;
+    block_options_t options = default_block_options();
+
+    static struct option long_options[] = {
+        {"speed", required_argument, NULL, 's'},
+        {"loop", no_argument, NULL, 'l'},
+        {"slots", required_argument, NULL, 'n'},
+        {"lock-free", no_argument, NULL, 'f'},
+        {NULL, 0, NULL, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (option) {
+            case 's':
+                speed = atof(optarg);
+                break;
+            case 'l':
+                loop = true;
+                break;
+            case 'n':
+                options.slot_count = strtoull(optarg, NULL, 10);
+                break;
+            case 'f':
+                options.sync_mode = SYNC_SEQLOCK;
+                break;
+            default:
+                return 2;
+        }
+    }
+    if (argc - optind != 2 || speed < 0) {
+        fprintf(stderr,
+                "usage: fbreplay [--speed FACTOR] [--loop] [--slots N] [--lock-free] file "
+                "direction\n");
+        return 2;
+    }
+    const char* path = argv[optind];
+    const char* direction = argv[optind + 1];
+
+    signal(SIGINT, interrupt);
+    signal(SIGTERM, interrupt);
+
+    recording_t* recording = open_recording(path);
+    if (recording == NULL) return 1;
+    size_t frame_count = recording_frame_count(recording);
+    if (frame_count == 0) {
+        fprintf(stderr, "%s holds no frames\n", path);
+        return 1;
+    }
+    block_t* block = create_replay_block(direction, recording, &options);
+    if (block == NULL) return 1;
+
+    size_t published = 0, dropped = 0;
+    bool failed = false;
+    uint64_t first_time = frame_time_ns(block, recording_frame(recording, 0)->acquisition_time);
+    do {
+        uint64_t start = now_ns();
+        for (size_t i = 0; i < frame_count && !interrupted && !failed; i++) {
+            const recorded_frame_t* frame = recording_frame(recording, i);
+            uint64_t time = frame_time_ns(block, frame->acquisition_time);
+            if (speed > 0 && time > first_time) sleep_until(start + (time - first_time) / speed);
+
+            int exit_code = replay_frame(block, recording, i);
+            if (exit_code == FRAME_DROPPED) {
+                dropped++;
+            } else if (exit_code != SUCCESS) {
+                fprintf(stderr, "failed to replay frame %zu: %d\n", i, exit_code);
+                failed = true;
+            } else {
+                published++;
+            }
+        }
+    } while (loop && !interrupted && !failed);
+
+    destroy_block(block);
+    close_recording(recording);
+    printf("replayed %zu frames of %s to %s", published, path, direction);
+    if (dropped > 0) printf(", %zu frames were dropped for reliable readers", dropped);
+    printf("\n");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,212 @@
+// Live statistics of every block on this machine, similar to top(1).
+//
+// Every [interval] seconds the blocks in the registry are listed and the counters of each
+// block and its readers are printed, with rates computed over the last interval. Blocks
+// only report their writer and reader counters if they were created with the [stats]
+// option, the others only show their frame rate.
+//
+//  - fps: frames written (or read) per second
+//  - skip: frames a reader skipped during the interval, because it fell behind, or frames
+//      the writer dropped for a reliable reader (BACKPRESSURE_SKIP)
+//  - wait: share of the interval a reader spent blocked waiting for new frames
+//  - lock: share of the interval spent waiting for the other side to release a slot
+//  - copy: average time spent copying one image in or out of the buffer
+//
+// usage:
+//      fbtop [--interval SECONDS] [--once] [direction...]
+//
+// --once prints a single snapshot of the totals and exits, e.g. for scripts.
+#include "buffer.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_BLOCKS MAX_LISTED_BLOCKS
+
+// a block that is being watched, along with the snapshot taken at the previous interval
+typedef struct watched_block {
+    char* direction;
+    block_t* block;
+    block_stats_t last;
+    bool seen;  // whether the block was listed during the current scan
+} watched_block_t;
+
+static const char* sync_names[] = {"rwlock", "seqlock"};
+
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static bool is_selected(const char* direction, char** selected, int selected_count) {
+    if (selected_count == 0) return true;
+    for (int i = 0; i < selected_count; i++)
+        if (strcmp(direction, selected[i]) == 0) return true;
+    return false;
+}
+
+// Opens every block in the registry (see [list_blocks]) that is not watched yet, and
+// marks the ones that are still listed as seen.
+static void scan_blocks(watched_block_t* blocks, size_t* block_count, char** selected,
+                        int selected_count) {
+    for (size_t i = 0; i < *block_count; i++) blocks[i].seen = false;
+
+    static block_info_t listed[MAX_LISTED_BLOCKS];
+    size_t listed_count = list_blocks(listed, MAX_LISTED_BLOCKS);
+    for (size_t j = 0; j < listed_count; j++) {
+        const char* direction = listed[j].direction;
+        if (!is_selected(direction, selected, selected_count)) continue;
+
+        size_t i = 0;
+        while (i < *block_count && strcmp(blocks[i].direction, direction) != 0) i++;
+        if (i < *block_count) {
+            blocks[i].seen = true;
+            continue;
+        }
+        if (*block_count == MAX_BLOCKS) continue;
+
+        block_t* block = open_block(direction);
+        if (block == NULL) continue;
+        watched_block_t* watched = &blocks[(*block_count)++];
+        watched->direction = strdup(direction);
+        watched->block = block;
+        block_stats(block, &watched->last);
+        watched->seen = true;
+    }
+}
+
+// Stops watching blocks that disappeared or died, so that a new writer of the same name
+// is picked up by the next scan.
+static void forget_stale_blocks(watched_block_t* blocks, size_t* block_count) {
+    size_t kept = 0;
+    for (size_t i = 0; i < *block_count; i++) {
+        if (blocks[i].seen && block_is_alive(blocks[i].block)) {
+            blocks[kept++] = blocks[i];
+            continue;
+        }
+        close_block(blocks[i].block);
+        free(blocks[i].direction);
+    }
+    *block_count = kept;
+}
+
+static const reader_stats_t* find_reader(const block_stats_t* stats, pid_t pid) {
+    for (size_t i = 0; i < stats->reader_count; i++)
+        if (stats->readers[i].pid == pid) return &stats->readers[i];
+    return NULL;
+}
+
+static double percent(uint64_t ns, double seconds) {
+    return seconds > 0 ? 100.0 * ns / 1e9 / seconds : 0;
+}
+
+static double micros_per_frame(uint64_t ns, uint64_t frames) {
+    return frames > 0 ? ns / 1e3 / frames : 0;
+}
+
+// Prints [now] next to the rates since [last], which was taken [seconds] ago. If
+// [seconds] is 0, the totals since the block was created are printed instead.
+static void print_block(const char* direction, const block_stats_t* now,
+                        const block_stats_t* last, double seconds) {
+    static const block_stats_t none = {0};
+    if (seconds == 0) last = &none;
+
+    char dimensions[64];
+    snprintf(dimensions, sizeof(dimensions), "%zux%zux%zu", now->width, now->height,
+             now->depth);
+    uint64_t written = now->frames_written - last->frames_written;
+    printf("%-20s %-15s %5zu %-8s %8d %12lu %8.1f", direction, dimensions, now->slot_count,
+           sync_names[now->sync_mode], now->owner, now->frames_written,
+           seconds > 0 ? written / seconds : 0);
+    if (!now->enabled) {
+        printf("   (stats disabled)\n");
+        return;
+    }
+    printf(" %10lu %7s %6.1f%% %8.1fus\n", now->frames_dropped - last->frames_dropped, "",
+           percent(now->write_lock_wait_ns - last->write_lock_wait_ns, seconds),
+           micros_per_frame(now->write_copy_ns - last->write_copy_ns, written));
+
+    for (size_t i = 0; i < now->reader_count; i++) {
+        const reader_stats_t* reader = &now->readers[i];
+        const reader_stats_t* previous = find_reader(last, reader->pid);
+        static const reader_stats_t no_reader = {0};
+        if (previous == NULL) previous = &no_reader;
+
+        uint64_t read = reader->frames_read - previous->frames_read;
+        char label[32];
+        snprintf(label, sizeof(label), "%d%s", reader->pid, reader->reliable ? " (reliable)" : "");
+        printf("  reader %-51s %12lu %8.1f %10lu %6.1f%% %6.1f%% %8.1fus\n", label,
+               reader->frames_read, seconds > 0 ? read / seconds : 0,
+               reader->frames_skipped - previous->frames_skipped,
+               percent(reader->frame_wait_ns - previous->frame_wait_ns, seconds),
+               percent(reader->lock_wait_ns - previous->lock_wait_ns, seconds),
+               micros_per_frame(reader->copy_ns - previous->copy_ns, read));
+    }
+}
+
+int main(int argc, char** argv) {
+    double interval = 1.0;
+    bool once = false;
+
+    static struct option long_options[] = {
+        {"interval", required_argument, NULL, 'i'},
+        {"once", no_argument, NULL, 'o'},
+        {NULL, 0, NULL, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (option) {
+            case 'i':
+                interval = atof(optarg);
+                break;
+            case 'o':
+                once = true;
+                break;
+            default:
+                return 2;
+        }
+    }
+    if (interval <= 0) {
+        fprintf(stderr, "--interval must be positive\n");
+        return 2;
+    }
+
+    static watched_block_t blocks[MAX_BLOCKS];
+    size_t block_count = 0;
+    uint64_t last_scan = now_ns();
+    scan_blocks(blocks, &block_count, argv + optind, argc - optind);
+
+    while (true) {
+        double seconds = 0;
+        if (!once) {
+            usleep(interval * 1e6);
+            uint64_t scan = now_ns();
+            seconds = (scan - last_scan) / 1e9;
+            last_scan = scan;
+            // clear the screen
+            printf("\033[H\033[2J");
+        }
+
+        printf("%-20s %-15s %5s %-8s %8s %12s %8s %10s %7s %7s %10s\n", "block", "size",
+               "slots", "sync", "pid", "frames", "fps", "skip", "wait", "lock", "copy");
+        for (size_t i = 0; i < block_count; i++) {
+            block_stats_t stats;
+            block_stats(blocks[i].block, &stats);
+            print_block(blocks[i].direction, &stats, &blocks[i].last, seconds);
+            blocks[i].last = stats;
+        }
+        fflush(stdout);
+        if (once) return 0;
+
+        // a block that was recreated under the same name is only opened again once its
+        // dead predecessor has been forgotten
+        scan_blocks(blocks, &block_count, argv + optind, argc - optind);
+        forget_stale_blocks(blocks, &block_count);
+        scan_blocks(blocks, &block_count, argv + optind, argc - optind);
+    }
+}